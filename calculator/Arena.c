@@ -0,0 +1,131 @@
+#include "Arena.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_MIN_BLOCK 4096
+
+struct ArenaBlock {
+    ArenaBlock *next; // previous, full block
+    size_t size; // usable bytes
+    size_t used;
+};
+
+static size_t align_up(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// Data follows the header, rounded up to the alignment
+static char *block_data(ArenaBlock *block)
+{
+    return (char *)block + align_up(sizeof(ArenaBlock));
+}
+
+static void push_block(Arena *arena, size_t size)
+{
+    ArenaBlock *block = (ArenaBlock *)malloc(align_up(sizeof(ArenaBlock)) + size);
+    assert(block != NULL);
+    block->next = arena->block;
+    block->size = size;
+    block->used = 0;
+    arena->block = block;
+    arena->capacity += size;
+}
+
+Arena *create_arena(size_t capacity)
+{
+    Arena *arena = (Arena *)malloc(sizeof(Arena));
+    assert(arena != NULL);
+    arena->block = NULL;
+    arena->capacity = 0;
+    arena->last = NULL;
+    push_block(arena, align_up(capacity > ARENA_MIN_BLOCK ? capacity : ARENA_MIN_BLOCK));
+    return arena;
+}
+
+static void free_blocks(ArenaBlock *block)
+{
+    while (block) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void free_arena(Arena *arena)
+{
+    if (arena)
+        free_blocks(arena->block);
+    free(arena);
+}
+
+void reset_arena(Arena *arena)
+{
+    // Outgrown: merge into one block of the high-water capacity
+    if (arena->block->next) {
+        size_t capacity = arena->capacity;
+        free_blocks(arena->block);
+        arena->block = NULL;
+        arena->capacity = 0;
+        push_block(arena, capacity);
+    }
+    arena->block->used = 0;
+    arena->last = NULL;
+}
+
+int arena_outgrown(const Arena *arena)
+{
+    return arena->block->next != NULL;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    if (arena == NULL) {
+        void *ptr = malloc(size);
+        assert(ptr != NULL);
+        return ptr;
+    }
+
+    size = align_up(size);
+    ArenaBlock *block = arena->block;
+    if (block->size - block->used < size) {
+        // Double the arena, one block is enough after the next reset
+        push_block(arena, size > arena->capacity ? size : arena->capacity);
+        block = arena->block;
+    }
+    void *ptr = block_data(block) + block->used;
+    block->used += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t size)
+{
+    if (arena == NULL) {
+        ptr = realloc(ptr, size);
+        assert(ptr != NULL);
+        return ptr;
+    }
+
+    if (ptr != NULL && ptr == arena->last) {
+        ArenaBlock *block = arena->block;
+        size_t offset = (char *)ptr - block_data(block);
+        if (block->size - offset >= align_up(size)) {
+            block->used = offset + align_up(size);
+            return ptr;
+        }
+    }
+
+    void *fresh = arena_alloc(arena, size);
+    if (ptr != NULL)
+        memcpy(fresh, ptr, old_size < size ? old_size : size);
+    return fresh;
+}
+
+void arena_free(Arena *arena, void *ptr)
+{
+    if (arena == NULL)
+        free(ptr);
+}
@@ -0,0 +1,39 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator for everything that lives as long as one expression:
+// scanner, tokens, parser and AST. Nothing is freed on its own, the whole
+// arena is reset at once and keeps its capacity for the next expression.
+//
+// A NULL arena stands for the C heap, so the same code path can allocate
+// with or without an arena.
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock *block; // current block, earlier ones are chained behind
+    size_t capacity; // bytes in all blocks
+    void *last; // most recent allocation, may grow in place
+} Arena;
+
+Arena *create_arena(size_t capacity);
+void free_arena(Arena *arena);
+
+// Release every allocation, the memory is kept for reuse
+void reset_arena(Arena *arena);
+
+// The first block was not enough, reset_arena() would merge the blocks
+int arena_outgrown(const Arena *arena);
+
+// Aligned for any type
+void *arena_alloc(Arena *arena, size_t size);
+
+// The most recent allocation grows in place when the block has room
+void *arena_realloc(Arena *arena, void *ptr, size_t old_size, size_t size);
+
+// Only frees without an arena
+void arena_free(Arena *arena, void *ptr);
+
+#endif // ARENA_H
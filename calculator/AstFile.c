@@ -0,0 +1,310 @@
+#include "AstFile.h"
+#include "Symbol.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define AST_FILE_MMAP 0 // read into memory instead
+#else
+#define AST_FILE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// File layout, offsets are from the start of the file:
+//
+//   AstFileHeader
+//   AstFileEntry  entries[count]
+//   AstNode       nodes[node_count]   8-byte aligned
+//   char          text[text_size]     source of all expressions
+
+#define AST_FILE_MAGIC "CALCAST" // with its NUL, 8 bytes
+#define AST_FILE_BYTE_ORDER 0x01020304u
+
+typedef struct AstFileHeader {
+    char magic[8];
+    uint32_t version; // AST_FILE_VERSION
+    uint32_t byte_order; // AST_FILE_BYTE_ORDER as written
+    uint32_t node_size; // sizeof(AstNode)
+    uint32_t symbols; // symbol_table_hash() the ids refer to
+    uint32_t count; // expressions
+    uint32_t reserved;
+    uint64_t entries;
+    uint64_t nodes;
+    uint64_t node_count;
+    uint64_t text;
+    uint64_t text_size;
+} AstFileHeader;
+
+// One expression: nodes [first, first + size) with the root last, child
+// indices are relative to first
+typedef struct AstFileEntry {
+    uint32_t first;
+    uint32_t size;
+    uint32_t text; // offset in the text section
+    uint32_t length;
+} AstFileEntry;
+
+#define AST_FILE_ALIGN 8
+
+static uint64_t align_offset(uint64_t offset)
+{
+    return (offset + AST_FILE_ALIGN - 1) & ~(uint64_t)(AST_FILE_ALIGN - 1);
+}
+
+// Grow an array of item sized elements to hold needed ones
+static void *reserve(void *items, int *capacity, int needed, size_t item)
+{
+    if (needed <= *capacity)
+        return items;
+    int grown = *capacity ? *capacity * 2 : 16;
+    while (grown < needed)
+        grown *= 2;
+    items = realloc(items, grown * item);
+    assert(items != NULL);
+    *capacity = grown;
+    return items;
+}
+
+AstWriter *create_ast_writer()
+{
+    AstWriter *writer = (AstWriter *)calloc(1, sizeof(AstWriter));
+    assert(writer != NULL);
+    return writer;
+}
+
+void free_ast_writer(AstWriter *writer)
+{
+    if (writer) {
+        free(writer->nodes);
+        free(writer->entries);
+        free(writer->text);
+    }
+    free(writer);
+}
+
+int add_ast(AstWriter *writer, const char *expression, int length, const Ast *ast)
+{
+    if (ast->root == AST_NONE)
+        return -1;
+
+    // The root is the last node of a parsed tree
+    int size = ast->root + 1;
+    writer->nodes = (AstNode *)reserve(writer->nodes, &writer->capacity,
+        writer->size + size, sizeof(AstNode));
+    memcpy(writer->nodes + writer->size, ast->nodes, size * sizeof(AstNode));
+
+    writer->text = (char *)reserve(writer->text, &writer->text_capacity,
+        writer->text_size + length, 1);
+    memcpy(writer->text + writer->text_size, expression, length);
+
+    writer->entries = (AstFileEntry *)reserve(writer->entries, &writer->entries_capacity,
+        writer->count + 1, sizeof(AstFileEntry));
+    AstFileEntry *entry = &writer->entries[writer->count];
+    entry->first = writer->size;
+    entry->size = size;
+    entry->text = writer->text_size;
+    entry->length = length;
+
+    writer->size += size;
+    writer->text_size += length;
+    return writer->count++;
+}
+
+int save_ast_file(const AstWriter *writer, const char *path)
+{
+    AstFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, AST_FILE_MAGIC, sizeof(header.magic));
+    header.version = AST_FILE_VERSION;
+    header.byte_order = AST_FILE_BYTE_ORDER;
+    header.node_size = sizeof(AstNode);
+    header.symbols = symbol_table_hash();
+    header.count = writer->count;
+    header.entries = sizeof(AstFileHeader);
+    header.nodes = align_offset(header.entries + writer->count * sizeof(AstFileEntry));
+    header.node_count = writer->size;
+    header.text = header.nodes + writer->size * sizeof(AstNode);
+    header.text_size = writer->text_size;
+
+    FILE *stream = fopen(path, "wb");
+    if (stream == NULL)
+        return 0;
+    static const char padding[AST_FILE_ALIGN];
+    size_t gap = header.nodes - (header.entries + writer->count * sizeof(AstFileEntry));
+    int ok = fwrite(&header, sizeof(header), 1, stream) == 1
+        && fwrite(writer->entries, sizeof(AstFileEntry), writer->count, stream) == (size_t)writer->count
+        && fwrite(padding, 1, gap, stream) == gap
+        && fwrite(writer->nodes, sizeof(AstNode), writer->size, stream) == (size_t)writer->size
+        && fwrite(writer->text, 1, writer->text_size, stream) == (size_t)writer->text_size;
+    if (fclose(stream) != 0)
+        ok = 0;
+    return ok;
+}
+
+// Map or read the whole file
+static const char *read_file(const char *path, size_t *size)
+{
+#if AST_FILE_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        *size = st.st_size;
+        data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd); // the mapping stays valid
+    return data == MAP_FAILED ? NULL : (const char *)data;
+#else
+    FILE *stream = fopen(path, "rb");
+    if (stream == NULL)
+        return NULL;
+    char *data = NULL;
+    if (fseek(stream, 0, SEEK_END) == 0) {
+        long length = ftell(stream);
+        if (length > 0 && fseek(stream, 0, SEEK_SET) == 0) {
+            data = (char *)malloc(length);
+            if (data && fread(data, 1, length, stream) != (size_t)length) {
+                free(data);
+                data = NULL;
+            }
+            *size = length;
+        }
+    }
+    fclose(stream);
+    return data;
+#endif
+}
+
+static void release_file(const char *data, size_t size)
+{
+#if AST_FILE_MMAP
+    munmap((void *)data, size);
+#else
+    (void)size;
+    free((void *)data);
+#endif
+}
+
+// Sections must lie within the file, computed without overflow
+static int in_file(uint64_t offset, uint64_t count, uint64_t item, size_t size)
+{
+    return offset <= size && count <= (size - offset) / item;
+}
+
+AstFile *load_ast_file(const char *path)
+{
+    size_t size = 0;
+    const char *data = read_file(path, &size);
+    if (data == NULL)
+        return NULL;
+
+    const AstFileHeader *header = (const AstFileHeader *)data;
+    if (size < sizeof(AstFileHeader)
+        || memcmp(header->magic, AST_FILE_MAGIC, sizeof(header->magic)) != 0
+        || header->version != AST_FILE_VERSION
+        || header->byte_order != AST_FILE_BYTE_ORDER
+        || header->node_size != sizeof(AstNode)
+        || header->symbols != symbol_table_hash()
+        || header->count > INT32_MAX
+        || header->entries % AST_FILE_ALIGN != 0 || header->nodes % AST_FILE_ALIGN != 0
+        || !in_file(header->entries, header->count, sizeof(AstFileEntry), size)
+        || !in_file(header->nodes, header->node_count, sizeof(AstNode), size)
+        || !in_file(header->text, header->text_size, 1, size)) {
+        release_file(data, size);
+        return NULL;
+    }
+
+    AstFile *file = (AstFile *)malloc(sizeof(AstFile));
+    assert(file != NULL);
+    file->data = data;
+    file->size = size;
+    file->count = header->count;
+    file->entries = (const AstFileEntry *)(data + header->entries);
+    file->nodes = (const AstNode *)(data + header->nodes);
+    file->text = data + header->text;
+    return file;
+}
+
+void free_ast_file(AstFile *file)
+{
+    if (file)
+        release_file(file->data, file->size);
+    free(file);
+}
+
+// A node the evaluator can run: children before their parent, operators
+// with their operands, names resolved to a symbol of the right kind
+static int check_node(const AstNode *node, int index, int length)
+{
+    const Token *token = &node->token;
+    if (token->position < 0 || token->length < 0 || token->position > length - token->length)
+        return 0;
+    for (int k = 0; k < 2; k++) {
+        if (node->child[k] != AST_NONE && (node->child[k] < 0 || node->child[k] >= index))
+            return 0;
+    }
+
+    int left = node->child[0] != AST_NONE;
+    int right = node->child[1] != AST_NONE;
+    switch (token->type) {
+    case FLOAT:
+    case INTEGER:
+        return !left && !right;
+    case PLUS:
+    case MINUS:
+        return left;
+    case MULT:
+    case DIV:
+    case POW:
+        return left && right;
+    case ID:
+        if (right || token->symbol < 0 || token->symbol >= symbol_count())
+            return 0;
+        return (get_symbol(token->symbol)->kind == SYMBOL_FUNCTION) == left;
+    default:
+        return 0;
+    }
+}
+
+int get_ast(const AstFile *file, int index, Ast *ast)
+{
+    if (index < 0 || index >= file->count)
+        return 0;
+
+    const AstFileHeader *header = (const AstFileHeader *)file->data;
+    const AstFileEntry *entry = &file->entries[index];
+    if (entry->size == 0 || entry->size > INT32_MAX
+        || entry->first > header->node_count || entry->size > header->node_count - entry->first
+        || entry->text > header->text_size || entry->length > header->text_size - entry->text)
+        return 0;
+
+    const AstNode *nodes = file->nodes + entry->first;
+    for (uint32_t i = 0; i < entry->size; i++) {
+        if (!check_node(&nodes[i], i, entry->length))
+            return 0;
+    }
+
+    ast->nodes = (AstNode *)nodes; // read-only mapping
+    ast->size = entry->size;
+    ast->capacity = entry->size;
+    ast->arena = NULL;
+    ast->root = entry->size - 1;
+    return 1;
+}
+
+const char *get_ast_text(const AstFile *file, int index, int *length)
+{
+    if (index < 0 || index >= file->count)
+        return NULL;
+    const AstFileEntry *entry = &file->entries[index];
+    *length = entry->length;
+    return file->text + entry->text;
+}
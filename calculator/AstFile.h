@@ -0,0 +1,62 @@
+#ifndef AST_FILE_H
+#define AST_FILE_H
+
+#include "Parser.h"
+#include <stddef.h>
+
+// Precompiled expressions: parsed ASTs with their literals decoded and
+// names resolved to symbol ids, saved together with the source text. The
+// file holds the AstNode array as it is in memory and only offsets and
+// indices, so a loaded file is mapped and evaluated in place.
+//
+// Files are native: a file written with another byte order, node layout,
+// format version or symbol table is rejected by load_ast_file().
+
+#define AST_FILE_VERSION 1
+
+// Collects expressions in memory until save_ast_file()
+typedef struct AstWriter {
+    AstNode *nodes;
+    int size;
+    int capacity;
+    struct AstFileEntry *entries;
+    int count;
+    int entries_capacity;
+    char *text;
+    int text_size;
+    int text_capacity;
+} AstWriter;
+
+AstWriter *create_ast_writer();
+void free_ast_writer(AstWriter *writer);
+
+// Copy a successfully parsed expression, returns its index in the file
+// or -1 for an empty tree
+int add_ast(AstWriter *writer, const char *expression, int length, const Ast *ast);
+
+// Returns 1 on success, 0 if the file can't be written
+int save_ast_file(const AstWriter *writer, const char *path);
+
+// A loaded file, mapped read-only
+typedef struct AstFile {
+    const char *data;
+    size_t size;
+    int count; // expressions
+    const struct AstFileEntry *entries;
+    const AstNode *nodes;
+    const char *text;
+} AstFile;
+
+// NULL if the file is missing, truncated or not compatible
+AstFile *load_ast_file(const char *path);
+void free_ast_file(AstFile *file);
+
+// View of expression index, checked to be a well formed tree first.
+// The nodes stay in the file, don't free_ast() or modify the view.
+// Returns 0 for a bad index or a damaged expression.
+int get_ast(const AstFile *file, int index, Ast *ast);
+
+// Source text of expression index, not NUL terminated
+const char *get_ast_text(const AstFile *file, int index, int *length);
+
+#endif // AST_FILE_H
@@ -0,0 +1,230 @@
+#include "Bytecode.h"
+#include "Symbol.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+typedef struct Compiler {
+    Bytecode *bytecode;
+    int code_capacity;
+    int constant_capacity;
+    int function_capacity;
+    int depth; // operand stack depth after the code so far
+} Compiler;
+
+// A node waiting for its operands in the depth-first walk
+typedef struct Visit {
+    int32_t node;
+    int32_t next; // child to visit next, 2 when done
+} Visit;
+
+static void *grow(void *items, int *capacity, size_t item)
+{
+    *capacity = *capacity ? *capacity * 2 : 16;
+    items = realloc(items, *capacity * item);
+    assert(items != NULL);
+    return items;
+}
+
+static void emit(Compiler *compiler, Opcode op, int arg, int effect)
+{
+    Bytecode *bytecode = compiler->bytecode;
+    if (bytecode->size == compiler->code_capacity)
+        bytecode->code = (Instruction *)grow(bytecode->code, &compiler->code_capacity, sizeof(Instruction));
+    bytecode->code[bytecode->size].op = op;
+    bytecode->code[bytecode->size].arg = arg;
+    bytecode->size++;
+
+    compiler->depth += effect;
+    if (compiler->depth > bytecode->max_stack)
+        bytecode->max_stack = compiler->depth;
+}
+
+static int add_constant(Compiler *compiler, double value)
+{
+    Bytecode *bytecode = compiler->bytecode;
+    if (bytecode->constant_count == compiler->constant_capacity)
+        bytecode->constants = (double *)grow(bytecode->constants, &compiler->constant_capacity, sizeof(double));
+    bytecode->constants[bytecode->constant_count] = value;
+    return bytecode->constant_count++;
+}
+
+static int add_function(Compiler *compiler, double (*function)(double))
+{
+    Bytecode *bytecode = compiler->bytecode;
+    if (bytecode->function_count == compiler->function_capacity)
+        bytecode->functions = (double (**)(double))grow(bytecode->functions,
+            &compiler->function_capacity, sizeof(*bytecode->functions));
+    bytecode->functions[bytecode->function_count] = function;
+    return bytecode->function_count++;
+}
+
+// Code of one node, its operands are on the stack
+static void emit_node(Compiler *compiler, const AstNode *node)
+{
+    const Token *token = &node->token;
+    int unary = node->child[1] == AST_NONE;
+    switch (token->type) {
+    case FLOAT:
+    case INTEGER:
+        emit(compiler, OP_CONST, add_constant(compiler, token->number), 1);
+        break;
+    case ID: {
+        const Symbol *symbol = get_symbol(token->symbol);
+        if (node->child[0] != AST_NONE)
+            emit(compiler, OP_CALL, add_function(compiler, symbol->function), 0);
+        else if (symbol->kind == SYMBOL_VARIABLE) // ans
+            emit(compiler, OP_ANS, 0, 1);
+        else
+            emit(compiler, OP_CONST, add_constant(compiler, symbol->value), 1);
+        break;
+    }
+    case PLUS:
+        if (!unary)
+            emit(compiler, OP_ADD, 0, -1);
+        break;
+    case MINUS:
+        if (unary)
+            emit(compiler, OP_NEG, 0, 0);
+        else
+            emit(compiler, OP_SUB, 0, -1);
+        break;
+    case MULT:
+        emit(compiler, OP_MUL, 0, -1);
+        break;
+    case DIV:
+        emit(compiler, OP_DIV, 0, -1);
+        break;
+    case POW:
+        emit(compiler, OP_POW, 0, -1);
+        break;
+    default:
+        assert(0 && "not an AST node");
+    }
+}
+
+Bytecode *compile_bytecode(const Ast *ast)
+{
+    assert(ast->root != AST_NONE);
+    Bytecode *bytecode = (Bytecode *)calloc(1, sizeof(Bytecode));
+    assert(bytecode != NULL);
+    Compiler compiler = { bytecode, 0, 0, 0, 0 };
+
+    // References from reachable parents, more than one in a DAG
+    int size = ast->root + 1;
+    int32_t *refs = (int32_t *)calloc(size, sizeof(int32_t));
+    int32_t *local = (int32_t *)malloc(size * sizeof(int32_t));
+    Visit *stack = (Visit *)malloc(size * sizeof(Visit));
+    assert(refs != NULL && local != NULL && stack != NULL);
+    refs[ast->root] = 1;
+    for (int i = ast->root; i >= 0; i--) {
+        local[i] = -1;
+        if (refs[i] == 0)
+            continue;
+        for (int k = 0; k < 2; k++) {
+            if (ast->nodes[i].child[k] != AST_NONE)
+                refs[ast->nodes[i].child[k]]++;
+        }
+    }
+
+    // Postorder walk, a shared operation is computed once into a local.
+    // Shared leaves are pushed again, that is as cheap as a load.
+    int top = 0;
+    stack[top].node = ast->root;
+    stack[top++].next = 0;
+    while (top > 0) {
+        Visit *visit = &stack[top - 1];
+        const AstNode *node = &ast->nodes[visit->node];
+        if (visit->next == 0 && local[visit->node] >= 0) {
+            emit(&compiler, OP_LOAD, local[visit->node], 1);
+            top--;
+            continue;
+        }
+        if (visit->next < 2) {
+            int child = node->child[visit->next++];
+            if (child != AST_NONE) {
+                stack[top].node = child;
+                stack[top++].next = 0;
+            }
+            continue;
+        }
+        emit_node(&compiler, node);
+        if (refs[visit->node] > 1 && node->child[0] != AST_NONE) {
+            local[visit->node] = bytecode->locals++;
+            emit(&compiler, OP_STORE, local[visit->node], 0);
+        }
+        top--;
+    }
+    emit(&compiler, OP_RETURN, 0, -1);
+
+    free(refs);
+    free(local);
+    free(stack);
+    return bytecode;
+}
+
+void free_bytecode(Bytecode *bytecode)
+{
+    if (bytecode) {
+        free(bytecode->code);
+        free(bytecode->constants);
+        free(bytecode->functions);
+    }
+    free(bytecode);
+}
+
+int bytecode_memory(const Bytecode *bytecode)
+{
+    return bytecode->locals + bytecode->max_stack;
+}
+
+double run_bytecode(const Bytecode *bytecode, double ans, double *memory)
+{
+    double *locals = memory;
+    double *sp = memory + bytecode->locals; // next free stack slot
+    const double *constants = bytecode->constants;
+    for (const Instruction *ip = bytecode->code;; ip++) {
+        switch (ip->op) {
+        case OP_CONST:
+            *sp++ = constants[ip->arg];
+            break;
+        case OP_ANS:
+            *sp++ = ans;
+            break;
+        case OP_LOAD:
+            *sp++ = locals[ip->arg];
+            break;
+        case OP_STORE:
+            locals[ip->arg] = sp[-1];
+            break;
+        case OP_NEG:
+            sp[-1] = -sp[-1];
+            break;
+        case OP_ADD:
+            sp--;
+            sp[-1] = sp[-1] + sp[0];
+            break;
+        case OP_SUB:
+            sp--;
+            sp[-1] = sp[-1] - sp[0];
+            break;
+        case OP_MUL:
+            sp--;
+            sp[-1] = sp[-1] * sp[0];
+            break;
+        case OP_DIV:
+            sp--;
+            sp[-1] = sp[-1] / sp[0];
+            break;
+        case OP_POW:
+            sp--;
+            sp[-1] = pow(sp[-1], sp[0]);
+            break;
+        case OP_CALL:
+            sp[-1] = bytecode->functions[ip->arg](sp[-1]);
+            break;
+        default: // OP_RETURN
+            return sp[-1];
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "Parser.h"
+#include <stdint.h>
+
+// A parsed expression compiled to code for a stack machine. Literals and
+// constants become pushes of a value from the constant pool, calls refer
+// to the function directly, so running it needs neither the AST nor the
+// symbol table. Subexpressions shared in a hash-consed AST are computed
+// once and kept in a local.
+
+typedef enum {
+    OP_CONST, // push constants[arg]
+    OP_ANS, // push the ans variable
+    OP_LOAD, // push locals[arg]
+    OP_STORE, // locals[arg] = top, the value stays on the stack
+    OP_NEG,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_POW,
+    OP_CALL, // top = functions[arg](top)
+    OP_RETURN // pop the result
+} Opcode;
+
+typedef struct Instruction {
+    int32_t op;
+    int32_t arg;
+} Instruction;
+
+typedef struct Bytecode {
+    Instruction *code;
+    int size;
+    double *constants;
+    int constant_count;
+    double (**functions)(double);
+    int function_count;
+    int max_stack; // deepest the operand stack gets
+    int locals; // shared subexpressions
+} Bytecode;
+
+// Compile a well formed tree, e.g. of a successful parse or get_ast().
+// The result doesn't refer to the AST.
+Bytecode *compile_bytecode(const Ast *ast);
+void free_bytecode(Bytecode *bytecode);
+
+// Doubles of working memory run_bytecode() needs
+int bytecode_memory(const Bytecode *bytecode);
+
+// Run with memory of bytecode_memory() doubles, ans is the value of the
+// ans variable
+double run_bytecode(const Bytecode *bytecode, double ans, double *memory);
+
+#endif // BYTECODE_H
@@ -1,25 +1,19 @@
-// #define _USE_MATH_DEFINES
-
 #include "Calculator.h"
+#include "Symbol.h"
 #include "strext.h"
+#include <assert.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+double eval(Calculator *calculator, const Ast *ast);
+double perform_operation(Calculator *calculator, const AstNode *node, const double *values);
+double function_call(Calculator *calculator, const AstNode *node, double arg);
+double fetch_constant(Calculator *calculator, const AstNode *node);
 
-#ifndef M_PI
-#define M_PI 3.1415926535897932384626434
-#endif
-#ifndef M_E
-#define M_E 2.7182818284590452353602875
-#endif
-#ifndef M_PHI
-#define M_PHI 1.6180339887498948482045868
-#endif
-
-double eval(Calculator *calculator, AstNode *ast);
-double perform_operation(Calculator *calculator, AstNode *ast);
-double function_call(Calculator *calculator, AstNode *ast);
-double fetch_constant(Calculator *calculator, AstNode *ast);
+// Initial arena, it grows to the largest expression seen
+#define CALCULATOR_ARENA_SIZE (64 * 1024)
 
 Calculator *create_calculator()
 {
@@ -27,37 +21,84 @@ Calculator *create_calculator()
     calculator->expression = NULL;
     calculator->status = 1;
     calculator->ans = 0.0;
-    calculator->parser = NULL;
+    calculator->parse_mode = PARSE_BATCH;
+    calculator->max_depth = PARSER_MAX_DEPTH;
+    calculator->hash_cons = 0;
+    calculator->fold = 1;
+    calculator->fast_math = 0;
+    calculator->engine = ENGINE_REGISTER;
+    calculator->diagnostics = create_diagnostics(DIAGNOSTICS_PRINT);
+    calculator->arena = create_arena(CALCULATOR_ARENA_SIZE);
+    // Created once, every expression reuses it
+    calculator->parser = create_parser("", calculator->parse_mode,
+        calculator->diagnostics, calculator->arena);
+    calculator->values = NULL;
+    calculator->values_capacity = 0;
     return calculator;
 }
 
 void free_calculator(Calculator *calculator)
 {
     if (calculator) {
-        free_parser(calculator->parser);
+        free_arena(calculator->arena); // parser included
+        free_diagnostics(calculator->diagnostics);
+        free(calculator->values);
         free(calculator);
     }
 }
 
-void recreate_parser(Calculator *calculator, const char *expression)
+void calculator_reset(Calculator *calculator, const char *expression, int length)
 {
-    // Release previous parser
-    if (calculator->parser) {
-        free_parser(calculator->parser);
-        calculator->parser = NULL;
-    }
     calculator->status = 1;
     // calculator->ans = 0.0; // keep previous answer
     calculator->expression = expression;
-    calculator->parser = create_parser(expression);
+    if (arena_outgrown(calculator->arena)) {
+        // Storage grew by reallocation and left old copies behind: reset
+        // to one block of the high-water size and build the parser again
+        reset_arena(calculator->arena);
+        calculator->parser = create_parser("", calculator->parse_mode,
+            calculator->diagnostics, calculator->arena);
+    }
+    reset_diagnostics(calculator->diagnostics, expression);
+    calculator->parser->mode = calculator->parse_mode;
+    calculator->parser->max_depth = calculator->max_depth;
+    calculator->parser->hash_cons = calculator->hash_cons;
+    reset_parser(calculator->parser, expression, length);
     parse(calculator->parser);
+    if (calculator->parser->status) {
+        if (calculator->fold)
+            fold_constants(calculator->parser->ast);
+        if (calculator->fast_math)
+            rewrite_fast_math(calculator->parser->ast);
+    }
 }
 
-double calculate(Calculator *calculator)
+void recreate_parser(Calculator *calculator, const char *expression)
+{
+    calculator_reset(calculator, expression, strlen(expression));
+}
+
+const Diagnostic *get_diagnostics(const Calculator *calculator, int *count)
+{
+    *count = calculator->diagnostics->size;
+    return calculator->diagnostics->items;
+}
+
+// Working memory of eval() and calculator_run()
+static void reserve_values(Calculator *calculator, int size)
+{
+    double *values = (double *)realloc(calculator->values, size * sizeof(double));
+    assert(values != NULL);
+    calculator->values = values;
+    calculator->values_capacity = size;
+}
+
+// Evaluate and keep the answer, an empty expression has none
+static double evaluate(Calculator *calculator, const Ast *ast)
 {
     double ans = 0.0;
-    if (calculator->parser && calculator->parser->status) {
-        ans = eval(calculator, calculator->parser->ast);
+    if (ast->root != AST_NONE) {
+        ans = eval(calculator, ast);
         if (calculator->status)
             calculator->ans = ans; // update
     } else {
@@ -66,42 +107,147 @@ double calculate(Calculator *calculator)
     return ans;
 }
 
-double eval(Calculator *calculator, AstNode *ast)
+double calculate(Calculator *calculator)
+{
+    if (calculator->parser && calculator->parser->status)
+        return evaluate(calculator, calculator->parser->ast);
+    calculator->status = 0;
+    return 0.0;
+}
+
+double calculate_ast(Calculator *calculator, const char *expression, const Ast *ast)
 {
-    char *endptr;
-    if (ast->token->type == FLOAT) {
-        return strtod(ast->token->literal, &endptr);
-    } else if (ast->token->type == INTEGER) {
-        return (double)strtol(ast->token->literal, &endptr, 10);
-    } else if (ast->token->type == ID) {
-        if (ast->firstChild) { // function call
-            return function_call(calculator, ast);
-        } else { // constant
-            return fetch_constant(calculator, ast);
+    calculator->status = 1;
+    calculator->expression = expression;
+    reset_diagnostics(calculator->diagnostics, expression);
+    return evaluate(calculator, ast);
+}
+
+Program *calculator_compile(Calculator *calculator)
+{
+    if (!calculator->parser->status || calculator->parser->ast->root == AST_NONE) {
+        calculator->status = 0;
+        return NULL;
+    }
+    return compile_program(calculator->parser->ast, calculator->engine);
+}
+
+Program *compile_program(const Ast *ast, Engine engine)
+{
+    Program *program = (Program *)malloc(sizeof(Program));
+    assert(program != NULL);
+    if (engine == ENGINE_CLOSURE) {
+        program->code.closures = compile_closures(ast);
+        engine = program->code.closures ? ENGINE_CLOSURE : ENGINE_REGISTER;
+    } else if (engine == ENGINE_JIT) {
+        program->code.jit = compile_jit(ast);
+        engine = program->code.jit ? ENGINE_JIT : ENGINE_REGISTER;
+    }
+    program->engine = engine;
+    switch (engine) {
+    case ENGINE_BYTECODE:
+        program->code.bytecode = compile_bytecode(ast);
+        program->memory = bytecode_memory(program->code.bytecode);
+        break;
+    case ENGINE_REGISTER:
+        program->code.registers = compile_register_code(ast);
+        program->memory = register_code_memory(program->code.registers);
+        break;
+    case ENGINE_CLOSURE:
+        program->memory = 0; // on the C stack
+        break;
+    case ENGINE_JIT:
+        program->memory = program->code.jit->registers;
+        break;
+    }
+    return program;
+}
+
+void free_program(Program *program)
+{
+    if (program) {
+        switch (program->engine) {
+        case ENGINE_BYTECODE:
+            free_bytecode(program->code.bytecode);
+            break;
+        case ENGINE_REGISTER:
+            free_register_code(program->code.registers);
+            break;
+        case ENGINE_CLOSURE:
+            free_closures(program->code.closures);
+            break;
+        case ENGINE_JIT:
+            free_jit(program->code.jit);
+            break;
         }
-    } else {
-        return perform_operation(calculator, ast);
     }
-    return 0.0;
+    free(program);
+}
+
+double calculator_run(Calculator *calculator, const Program *program)
+{
+    if (program->memory > calculator->values_capacity)
+        reserve_values(calculator, program->memory);
+    double ans = 0.0;
+    switch (program->engine) {
+    case ENGINE_BYTECODE:
+        ans = run_bytecode(program->code.bytecode, calculator->ans, calculator->values);
+        break;
+    case ENGINE_REGISTER:
+        ans = run_register_code(program->code.registers, calculator->ans, calculator->values);
+        break;
+    case ENGINE_CLOSURE:
+        ans = run_closures(program->code.closures, calculator->ans);
+        break;
+    case ENGINE_JIT:
+        ans = run_jit(program->code.jit, calculator->ans, calculator->values);
+        break;
+    }
+    calculator->status = 1;
+    calculator->ans = ans;
+    return ans;
 }
 
-double perform_operation(Calculator *calculator, AstNode *ast)
+// Children precede their parent, so one pass in array order evaluates
+// every operand before it is used
+double eval(Calculator *calculator, const Ast *ast)
 {
-    double left = eval(calculator, ast->firstChild);
-    if (!calculator->status)
-        return 0.0;
+    int size = ast->root + 1; // nodes after the root are unreachable
+    if (size > calculator->values_capacity)
+        reserve_values(calculator, size);
 
+    double *values = calculator->values;
+    for (int i = 0; i < size; i++) {
+        const AstNode *node = &ast->nodes[i];
+        if (node->token.type == FLOAT || node->token.type == INTEGER) {
+            values[i] = node->token.number; // decoded by the scanner
+        } else if (node->token.type == ID) {
+            if (node->child[0] != AST_NONE) { // function call
+                values[i] = function_call(calculator, node, values[node->child[0]]);
+            } else { // constant
+                values[i] = fetch_constant(calculator, node);
+            }
+        } else {
+            values[i] = perform_operation(calculator, node, values);
+            if (!calculator->status)
+                return 0.0;
+        }
+    }
+    return values[ast->root];
+}
+
+double perform_operation(Calculator *calculator, const AstNode *node, const double *values)
+{
+    double left = values[node->child[0]];
     double right = 0.0;
     int is_unary = 1;
 
-    if (ast->firstChild->nextSibling) {
-        right = eval(calculator, ast->firstChild->nextSibling);
-        if (!calculator->status)
-            return 0.0;
+    if (node->child[1] != AST_NONE) {
+        right = values[node->child[1]];
         is_unary = 0;
     }
 
-    switch (ast->token->type) {
+    switch (node->token.type) {
     case PLUS:
         if (is_unary)
             return left;
@@ -117,82 +263,24 @@ double perform_operation(Calculator *calculator, AstNode *ast)
     case POW:
         return pow(left, right);
     default:
-        fprintf(stderr, "Unkown operation: %s!\n",
-            ast->token->literal);
+        report_diagnostic(calculator->diagnostics, DIAG_UNKNOWN_OPERATION,
+            node->token.position, node->token.length);
         calculator->status = 0;
     }
     return 0.0;
 }
 
-double function_call(Calculator *calculator, AstNode *ast)
-{
-    double (*func_ptr)(double);
-    if (strcasecmp(ast->token->literal, "sin") == 0) {
-        func_ptr = sin;
-    } else if (strcasecmp(ast->token->literal, "cos") == 0) {
-        func_ptr = cos;
-    } else if (strcasecmp(ast->token->literal, "tan") == 0) {
-        func_ptr = tan;
-    } else if (strcasecmp(ast->token->literal, "asin") == 0) {
-        func_ptr = asin;
-    } else if (strcasecmp(ast->token->literal, "acos") == 0) {
-        func_ptr = acos;
-    } else if (strcasecmp(ast->token->literal, "atan") == 0) {
-        func_ptr = atan;
-    } else if (strcasecmp(ast->token->literal, "sinh") == 0) {
-        func_ptr = sinh;
-    } else if (strcasecmp(ast->token->literal, "cosh") == 0) {
-        func_ptr = cosh;
-    } else if (strcasecmp(ast->token->literal, "tanh") == 0) {
-        func_ptr = tanh;
-    } else if (strcasecmp(ast->token->literal, "asinh") == 0) {
-        func_ptr = asinh;
-    } else if (strcasecmp(ast->token->literal, "acosh") == 0) {
-        func_ptr = acosh;
-    } else if (strcasecmp(ast->token->literal, "atanh") == 0) {
-        func_ptr = atanh;
-    } else if (strcasecmp(ast->token->literal, "exp") == 0) {
-        func_ptr = exp;
-    } else if (strcasecmp(ast->token->literal, "log") == 0) {
-        func_ptr = log;
-    } else if (strcasecmp(ast->token->literal, "log10") == 0) {
-        func_ptr = log10;
-    } else if (strcasecmp(ast->token->literal, "log2") == 0) {
-        func_ptr = log2;
-    } else if (strcasecmp(ast->token->literal, "sqrt") == 0) {
-        func_ptr = sqrt;
-    } else if (strcasecmp(ast->token->literal, "cbrt") == 0) {
-        func_ptr = cbrt;
-    } else if (strcasecmp(ast->token->literal, "ceil") == 0) {
-        func_ptr = ceil;
-    } else if (strcasecmp(ast->token->literal, "floor") == 0) {
-        func_ptr = floor;
-    } else if (strcasecmp(ast->token->literal, "fabs") == 0) {
-        func_ptr = fabs;
-    } else {
-        fprintf(stderr, "Unkown function: %s!\n", ast->token->literal);
-        calculator->status = 0;
-    }
-
-    double arg = eval(calculator, ast->firstChild);
-    if (calculator->status)
-        return func_ptr(arg);
-    return 0.0;
+// Symbols are resolved by the scanner and checked by the parser
+double function_call(Calculator *calculator, const AstNode *node, double arg)
+{
+    (void)calculator;
+    return get_symbol(node->token.symbol)->function(arg);
 }
 
-double fetch_constant(Calculator *calculator, AstNode *ast)
+double fetch_constant(Calculator *calculator, const AstNode *node)
 {
-    if (strcasecmp(ast->token->literal, "ans") == 0) {
+    const Symbol *symbol = get_symbol(node->token.symbol);
+    if (symbol->kind == SYMBOL_VARIABLE) // ans
         return calculator->ans;
-    } else if (strcasecmp(ast->token->literal, "pi") == 0) {
-        return M_PI;
-    } else if (strcasecmp(ast->token->literal, "e") == 0) {
-        return M_E;
-    } else if (strcasecmp(ast->token->literal, "phi") == 0) {
-        return M_PHI;
-    } else {
-        fprintf(stderr, "Unkown constant name: %s!\n", ast->token->literal);
-        calculator->status = 0;
-    }
-    return 0.0;
+    return symbol->value;
 }
@@ -1,18 +1,73 @@
 #ifndef CALCULATOR_H
 #define CALCULATOR_H
 
+#include "Bytecode.h"
+#include "Closure.h"
+#include "Jit.h"
+#include "Optimizer.h"
 #include "Parser.h"
+#include "RegisterCode.h"
+
+// Engines for compiled expressions, see calculator_compile()
+typedef enum {
+    ENGINE_BYTECODE, // stack machine, Bytecode.h
+    ENGINE_REGISTER, // three-address code with fused instructions, RegisterCode.h
+    ENGINE_CLOSURE, // tree of specialized closures, Closure.h
+    ENGINE_JIT // x86-64 machine code, Jit.h
+} Engine;
+
+typedef struct Program {
+    Engine engine;
+    int memory; // doubles of working memory
+    union {
+        Bytecode *bytecode;
+        RegisterCode *registers;
+        ClosureTree *closures;
+        JitCode *jit;
+    } code;
+} Program;
 
 typedef struct Calculator {
     const char *expression;
-    Parser *parser;
+    Parser *parser; // allocated from arena, reused by calculator_reset()
+    Arena *arena; // parser, scanner, tokens and AST
+    ParseMode parse_mode; // PARSE_BATCH by default
+    int max_depth; // nesting limit, PARSER_MAX_DEPTH by default
+    int hash_cons; // evaluate repeated subexpressions once, off by default
+    int fold; // fold_constants() after parsing, on by default
+    int fast_math; // rewrite_fast_math() after folding, inexact, off by default
+    Engine engine; // of calculator_compile(), ENGINE_REGISTER by default
+    Diagnostics *diagnostics; // errors of the last expression
+    double *values; // node values of the last evaluation
+    int values_capacity;
     double ans;
     int status; // 1 for success, 0 for failure
 } Calculator;
 
 Calculator *create_calculator();
+// Parse the length characters at expression, which need not be NUL
+// terminated. The parser and its storage are reused.
+void calculator_reset(Calculator *calculator, const char *expression, int length);
+// calculator_reset() for a NUL terminated expression
 void recreate_parser(Calculator *calculator, const char *expression);
 double calculate(Calculator *calculator);
+// Evaluate a tree parsed elsewhere, e.g. one loaded with get_ast().
+// expression is its source text, errors refer to positions in it.
+double calculate_ast(Calculator *calculator, const char *expression, const Ast *ast);
 void free_calculator(Calculator *calculator);
 
+// Compile once, run many: the last expression compiled for the engine,
+// NULL if it failed to parse or is empty
+Program *calculator_compile(Calculator *calculator);
+// Evaluate compiled code with the current ans and update ans
+double calculator_run(Calculator *calculator, const Program *program);
+// Compile a well formed tree, e.g. from get_ast() or parse_lines(). A tree
+// too deep for ENGINE_CLOSURE, or ENGINE_JIT where there is no JIT, is
+// compiled for ENGINE_REGISTER instead.
+Program *compile_program(const Ast *ast, Engine engine);
+void free_program(Program *program);
+
+// Errors of the last expression, valid until the next calculator_reset()
+const Diagnostic *get_diagnostics(const Calculator *calculator, int *count);
+
 #endif
\ No newline at end of file
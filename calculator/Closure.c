@@ -0,0 +1,324 @@
+#include "Closure.h"
+#include "Symbol.h"
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define EVAL(closure) ((closure)->eval((closure), ans))
+
+// Leaves
+
+static double eval_const(const Closure *closure, double ans)
+{
+    (void)ans;
+    return closure->value;
+}
+
+static double eval_ans(const Closure *closure, double ans)
+{
+    (void)closure;
+    return ans;
+}
+
+// A node of several parents, run_closures() stored its value in the
+// slot closure
+static double eval_shared(const Closure *closure, double ans)
+{
+    (void)ans;
+    return closure->right->value;
+}
+
+// Operators, the const_lhs and const_rhs forms have the constant in value
+
+static double eval_neg(const Closure *closure, double ans)
+{
+    return -EVAL(closure->left);
+}
+
+#define BINARY_CLOSURES(name, op)                                     \
+    static double eval_##name(const Closure *closure, double ans)     \
+    {                                                                 \
+        double left = EVAL(closure->left);                            \
+        return left op EVAL(closure->right);                          \
+    }                                                                 \
+    static double name##_const_lhs(const Closure *closure, double ans) \
+    {                                                                 \
+        return closure->value op EVAL(closure->right);                \
+    }                                                                 \
+    static double name##_const_rhs(const Closure *closure, double ans) \
+    {                                                                 \
+        return EVAL(closure->left) op closure->value;                 \
+    }
+
+BINARY_CLOSURES(add, +)
+BINARY_CLOSURES(sub, -)
+BINARY_CLOSURES(mul, *)
+BINARY_CLOSURES(div, /)
+
+static double eval_pow(const Closure *closure, double ans)
+{
+    double left = EVAL(closure->left);
+    return pow(left, EVAL(closure->right));
+}
+
+static double pow_const_rhs(const Closure *closure, double ans)
+{
+    return pow(EVAL(closure->left), closure->value);
+}
+
+// x*x of one node, as fast math writes x^2, evaluates x once
+static double eval_square(const Closure *closure, double ans)
+{
+    double left = EVAL(closure->left);
+    return left * left;
+}
+
+// Calls, the builtins get a direct call each
+
+static double eval_call(const Closure *closure, double ans)
+{
+    return closure->function(EVAL(closure->left));
+}
+
+#define CALL_CLOSURE(name)                                        \
+    static double call_##name(const Closure *closure, double ans) \
+    {                                                             \
+        return name(EVAL(closure->left));                         \
+    }
+
+CALL_CLOSURE(sin)
+CALL_CLOSURE(cos)
+CALL_CLOSURE(tan)
+CALL_CLOSURE(asin)
+CALL_CLOSURE(acos)
+CALL_CLOSURE(atan)
+CALL_CLOSURE(sinh)
+CALL_CLOSURE(cosh)
+CALL_CLOSURE(tanh)
+CALL_CLOSURE(asinh)
+CALL_CLOSURE(acosh)
+CALL_CLOSURE(atanh)
+CALL_CLOSURE(exp)
+CALL_CLOSURE(log)
+CALL_CLOSURE(log10)
+CALL_CLOSURE(log2)
+CALL_CLOSURE(sqrt)
+CALL_CLOSURE(cbrt)
+CALL_CLOSURE(ceil)
+CALL_CLOSURE(floor)
+CALL_CLOSURE(fabs)
+
+static const struct {
+    double (*function)(double);
+    ClosureFunction eval;
+} direct_calls[] = {
+    { sin, call_sin },
+    { cos, call_cos },
+    { tan, call_tan },
+    { asin, call_asin },
+    { acos, call_acos },
+    { atan, call_atan },
+    { sinh, call_sinh },
+    { cosh, call_cosh },
+    { tanh, call_tanh },
+    { asinh, call_asinh },
+    { acosh, call_acosh },
+    { atanh, call_atanh },
+    { exp, call_exp },
+    { log, call_log },
+    { log10, call_log10 },
+    { log2, call_log2 },
+    { sqrt, call_sqrt },
+    { cbrt, call_cbrt },
+    { ceil, call_ceil },
+    { floor, call_floor },
+    { fabs, call_fabs },
+};
+
+static ClosureFunction call_closure(double (*function)(double))
+{
+    for (size_t i = 0; i < sizeof(direct_calls) / sizeof(direct_calls[0]); i++) {
+        if (direct_calls[i].function == function)
+            return direct_calls[i].eval;
+    }
+    return eval_call;
+}
+
+// Operator closures: plain, constant left operand, constant right operand
+static const ClosureFunction binary_closures[][3] = {
+    { eval_add, add_const_lhs, add_const_rhs }, // PLUS
+    { eval_sub, sub_const_lhs, sub_const_rhs }, // MINUS
+    { eval_mul, mul_const_lhs, mul_const_rhs }, // MULT
+    { eval_div, div_const_lhs, div_const_rhs }, // DIV
+    { eval_pow, NULL, pow_const_rhs }, // POW
+};
+
+static int is_const(const Closure *closure)
+{
+    return closure->eval == eval_const;
+}
+
+static void set_binary(Closure *closure, TokenType type, const Closure *left, const Closure *right)
+{
+    const ClosureFunction *forms = binary_closures[type - PLUS];
+    if (type == MULT && left == right) {
+        closure->eval = eval_square;
+        closure->left = left;
+    } else if (is_const(right)) {
+        closure->eval = forms[2];
+        closure->left = left;
+        closure->value = right->value;
+    } else if (is_const(left) && forms[1] != NULL) {
+        closure->eval = forms[1];
+        closure->right = right;
+        closure->value = left->value;
+    } else {
+        closure->eval = forms[0];
+        closure->left = left;
+        closure->right = right;
+    }
+}
+
+// The depth is at most the number of nodes, only a large tree is checked
+static int too_deep(const Ast *ast)
+{
+    int size = ast->root + 1;
+    if (size <= CLOSURE_MAX_DEPTH)
+        return 0;
+    int *depth = (int *)malloc(size * sizeof(int));
+    assert(depth != NULL);
+    int deep = 0;
+    for (int i = 0; i < size && !deep; i++) {
+        depth[i] = 1;
+        for (int k = 0; k < 2; k++) {
+            int child = ast->nodes[i].child[k];
+            if (child != AST_NONE && depth[i] < 1 + depth[child])
+                depth[i] = 1 + depth[child];
+        }
+        deep = depth[i] > CLOSURE_MAX_DEPTH;
+    }
+    free(depth);
+    return deep;
+}
+
+// Parents of each node, x*x of one node counts once as it is evaluated
+// once. Children come first, so a pass from the root down sees every
+// parent of a node before the node itself.
+static int32_t *count_parents(const Ast *ast)
+{
+    int size = ast->root + 1;
+    int32_t *refs = (int32_t *)calloc(size, sizeof(int32_t));
+    assert(refs != NULL);
+    refs[ast->root] = 1;
+    for (int i = ast->root; i >= 0; i--) {
+        const AstNode *node = &ast->nodes[i];
+        if (refs[i] == 0)
+            continue;
+        for (int k = 0; k < 2; k++) {
+            if (node->child[k] != AST_NONE && (k == 0 || node->child[1] != node->child[0]))
+                refs[node->child[k]]++;
+        }
+    }
+    return refs;
+}
+
+ClosureTree *compile_closures(const Ast *ast)
+{
+    assert(ast->root != AST_NONE);
+    if (too_deep(ast))
+        return NULL;
+
+    // Shared nodes that compute something get a slot
+    int size = ast->root + 1;
+    int32_t *refs = count_parents(ast);
+    int shared_count = 0;
+    for (int i = 0; i < size; i++) {
+        refs[i] = refs[i] > 1 && ast->nodes[i].child[0] != AST_NONE;
+        shared_count += refs[i];
+    }
+
+    // One block: closure i is the closure of node i, or the slot of a shared
+    // node whose closure is in bodies
+    ClosureTree *tree = (ClosureTree *)calloc(1, sizeof(ClosureTree)
+        + (size + shared_count) * sizeof(Closure) + shared_count * sizeof(int32_t));
+    assert(tree != NULL);
+    tree->closures = (Closure *)(tree + 1);
+    tree->bodies = tree->closures + size;
+    tree->shared = (int32_t *)(tree->bodies + shared_count);
+    tree->size = size;
+
+    // Children come first, their closures are ready for the parent
+    for (int i = 0; i < size; i++) {
+        const AstNode *node = &ast->nodes[i];
+        Closure *closure = refs[i] ? &tree->bodies[tree->shared_count] : &tree->closures[i];
+        const Closure *left = node->child[0] != AST_NONE ? &tree->closures[node->child[0]] : NULL;
+        const Closure *right = node->child[1] != AST_NONE ? &tree->closures[node->child[1]] : NULL;
+        switch (node->token.type) {
+        case FLOAT:
+        case INTEGER:
+            closure->eval = eval_const;
+            closure->value = node->token.number;
+            break;
+        case ID: {
+            const Symbol *symbol = get_symbol(node->token.symbol);
+            if (left != NULL) {
+                closure->function = symbol->function;
+                closure->eval = call_closure(symbol->function);
+                closure->left = left;
+            } else if (symbol->kind == SYMBOL_VARIABLE) { // ans
+                closure->eval = eval_ans;
+            } else {
+                closure->eval = eval_const;
+                closure->value = symbol->value;
+            }
+            break;
+        }
+        case PLUS:
+        case MINUS:
+            if (right == NULL) {
+                if (node->token.type == PLUS) {
+                    *closure = *left; // unary plus is the operand
+                } else {
+                    closure->eval = eval_neg;
+                    closure->left = left;
+                }
+                break;
+            }
+            // fall through
+        case MULT:
+        case DIV:
+        case POW:
+            set_binary(closure, node->token.type, left, right);
+            break;
+        default:
+            assert(0 && "not an AST node");
+        }
+
+        if (refs[i]) {
+            Closure *slot = &tree->closures[i];
+            slot->eval = eval_shared;
+            slot->left = closure;
+            slot->right = slot; // copies made by unary plus read it too
+            tree->shared[tree->shared_count++] = i;
+        }
+    }
+    tree->root = &tree->closures[ast->root];
+    free(refs);
+    return tree;
+}
+
+void free_closures(ClosureTree *tree)
+{
+    free(tree); // closures included
+}
+
+double run_closures(const ClosureTree *tree, double ans)
+{
+    // In node order, a shared node only reads the slots before it
+    for (int k = 0; k < tree->shared_count; k++) {
+        Closure *slot = &tree->closures[tree->shared[k]];
+        slot->value = slot->left->eval(slot->left, ans);
+    }
+    return tree->root->eval(tree->root, ans);
+}
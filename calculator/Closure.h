@@ -0,0 +1,47 @@
+#ifndef CLOSURE_H
+#define CLOSURE_H
+
+#include "Parser.h"
+#include <stdint.h>
+
+// A parsed expression compiled to a tree of closures: every node holds a
+// function specialized for its operation and operand kinds, such as
+// add_const_rhs() or call_sin(), and evaluating the tree is a call of the
+// root. Constant operands are stored in the node, unary plus is dropped.
+//
+// Evaluation recurses on the C stack, deeper trees are not compiled.
+// A node with several parents, from hash-consing or fast math, is computed
+// once per run before the root and its value read from a slot at each use.
+// The slots are in the tree, so one tree must not be run by two threads at
+// the same time.
+
+#define CLOSURE_MAX_DEPTH 4096
+
+typedef struct Closure Closure;
+typedef double (*ClosureFunction)(const Closure *closure, double ans);
+
+struct Closure {
+    ClosureFunction eval;
+    const Closure *left;
+    const Closure *right;
+    double value; // literal or constant operand
+    double (*function)(double); // builtin of a call
+};
+
+typedef struct ClosureTree {
+    Closure *closures;
+    int size;
+    const Closure *root;
+    Closure *bodies; // closures of the shared nodes
+    int32_t *shared; // shared nodes in order, their closures are slots
+    int shared_count;
+} ClosureTree;
+
+// Compile a well formed tree, e.g. of a successful parse or get_ast().
+// NULL if it is nested deeper than CLOSURE_MAX_DEPTH.
+ClosureTree *compile_closures(const Ast *ast);
+void free_closures(ClosureTree *tree);
+
+double run_closures(const ClosureTree *tree, double ans);
+
+#endif // CLOSURE_H
@@ -0,0 +1,129 @@
+#include "Diagnostics.h"
+#include <assert.h>
+#include <stdlib.h>
+
+#define DIAGNOSTICS_INIT_CAPACITY 8
+
+Diagnostics *create_diagnostics(DiagnosticsMode mode)
+{
+    Diagnostics *diagnostics = (Diagnostics *)malloc(sizeof(Diagnostics));
+    assert(diagnostics != NULL);
+    diagnostics->items = NULL;
+    diagnostics->size = 0;
+    diagnostics->capacity = 0;
+    diagnostics->mode = mode;
+    diagnostics->expression = NULL;
+    return diagnostics;
+}
+
+void free_diagnostics(Diagnostics *diagnostics)
+{
+    if (diagnostics)
+        free(diagnostics->items);
+    free(diagnostics);
+}
+
+void reset_diagnostics(Diagnostics *diagnostics, const char *expression)
+{
+    diagnostics->size = 0; // keep the buffer
+    diagnostics->expression = expression;
+}
+
+// Format diagnostics from first on, unbuffered streams then see one write
+static void write_diagnostics(const Diagnostics *diagnostics, int first, FILE *stream)
+{
+    if (first >= diagnostics->size)
+        return;
+
+    size_t capacity = 128 * (diagnostics->size - first);
+    size_t used = 0;
+    char *text = (char *)malloc(capacity);
+    assert(text != NULL);
+    for (int i = first; i < diagnostics->size; i++) {
+        const Diagnostic *diagnostic = &diagnostics->items[i];
+        int needed = format_diagnostic(diagnostics, diagnostic, NULL, 0) + 1;
+        if (used + needed + 1 > capacity) {
+            capacity = (used + needed + 1) * 2;
+            text = (char *)realloc(text, capacity);
+            assert(text != NULL);
+        }
+        used += format_diagnostic(diagnostics, diagnostic, text + used, capacity - used);
+        text[used++] = '\n';
+    }
+    fwrite(text, 1, used, stream);
+    free(text);
+}
+
+static DiagnosticCode diagnostic_code(DiagnosticId id)
+{
+    return id == DIAG_UNKNOWN_OPERATION ? DIAG_RUNTIME : DIAG_SYNTAX;
+}
+
+void report_diagnostic(Diagnostics *diagnostics, DiagnosticId id,
+    int position, int length)
+{
+    if (diagnostics == NULL)
+        return;
+
+    if (diagnostics->size == diagnostics->capacity) {
+        int capacity = diagnostics->capacity ? diagnostics->capacity * 2
+                                             : DIAGNOSTICS_INIT_CAPACITY;
+        Diagnostic *items = (Diagnostic *)realloc(diagnostics->items,
+            capacity * sizeof(Diagnostic));
+        assert(items != NULL);
+        diagnostics->items = items;
+        diagnostics->capacity = capacity;
+    }
+
+    Diagnostic *diagnostic = &diagnostics->items[diagnostics->size++];
+    diagnostic->code = diagnostic_code(id);
+    diagnostic->id = id;
+    diagnostic->position = position;
+    diagnostic->length = length;
+
+    if (diagnostics->mode == DIAGNOSTICS_PRINT)
+        write_diagnostics(diagnostics, diagnostics->size - 1, stderr);
+}
+
+int format_diagnostic(const Diagnostics *diagnostics,
+    const Diagnostic *diagnostic, char *buffer, size_t size)
+{
+    const char *text = diagnostics->expression + diagnostic->position;
+    int length = diagnostic->length;
+    int position = diagnostic->position + 1;
+
+    switch (diagnostic->id) {
+    case DIAG_ILLEGAL_NUMBER:
+        return snprintf(buffer, size, "Syntax Error: Illeagal number at position: %d.", position);
+    case DIAG_NUMBER_UNDERFLOW:
+        return snprintf(buffer, size, "Syntax Error: Numerical underflow at position: %d.", position);
+    case DIAG_NUMBER_OVERFLOW:
+        return snprintf(buffer, size, "Syntax Error: Numerical overflow at position: %d.", position);
+    case DIAG_ILLEGAL_CHARACTER:
+        return snprintf(buffer, size, "Syntax Error: Illeagal character: '%c' at position: %d.", *text, position);
+    case DIAG_UNEXPECTED_SYMBOL:
+        return snprintf(buffer, size, "Syntax Error: Unexpected symbol at position: %d.", position);
+    case DIAG_EXPECTED_RIGHT_OPERAND:
+        return snprintf(buffer, size, "Syntax Error: Expected right operand at position: %d.", position);
+    case DIAG_EXPECTED_UNARY_OPERAND:
+        return snprintf(buffer, size, "Syntax Error: Expected unary operand at position: %d.", position);
+    case DIAG_EXPECTED_RPAREN:
+        return snprintf(buffer, size, "Syntax Error: Expected ')' at position: %d.", position);
+    case DIAG_EXPECTED_ARGUMENT:
+        return snprintf(buffer, size, "Syntax Error: Expected argument at position: %d.", position);
+    case DIAG_UNKNOWN_FUNCTION:
+        return snprintf(buffer, size, "Syntax Error: Unknown function '%.*s' at position: %d.", length, text, position);
+    case DIAG_UNKNOWN_CONSTANT:
+        return snprintf(buffer, size, "Syntax Error: Unknown constant '%.*s' at position: %d.", length, text, position);
+    case DIAG_TOO_DEEP:
+        return snprintf(buffer, size, "Syntax Error: Expression nested too deeply at position: %d.", position);
+    case DIAG_UNKNOWN_OPERATION:
+        return snprintf(buffer, size, "Unkown operation: %.*s!", length, text);
+    }
+    return snprintf(buffer, size, "Error at position: %d.", position);
+}
+
+void print_diagnostics(const Diagnostics *diagnostics, FILE *stream)
+{
+    write_diagnostics(diagnostics, 0, stream);
+}
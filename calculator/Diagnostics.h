@@ -0,0 +1,70 @@
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#include <stdio.h>
+
+// Errors found while scanning, parsing or evaluating one expression are
+// recorded as (code, message id, position) and only formatted on demand.
+
+typedef enum {
+    DIAG_SYNTAX, // rejected by the scanner or the parser
+    DIAG_RUNTIME // raised during evaluation
+} DiagnosticCode;
+
+typedef enum {
+    // Scanner
+    DIAG_ILLEGAL_NUMBER,
+    DIAG_NUMBER_UNDERFLOW,
+    DIAG_NUMBER_OVERFLOW,
+    DIAG_ILLEGAL_CHARACTER,
+    // Parser
+    DIAG_UNEXPECTED_SYMBOL,
+    DIAG_EXPECTED_RIGHT_OPERAND,
+    DIAG_EXPECTED_UNARY_OPERAND,
+    DIAG_EXPECTED_RPAREN,
+    DIAG_EXPECTED_ARGUMENT,
+    DIAG_UNKNOWN_FUNCTION,
+    DIAG_UNKNOWN_CONSTANT,
+    DIAG_TOO_DEEP,
+    // Evaluator
+    DIAG_UNKNOWN_OPERATION
+} DiagnosticId;
+
+typedef struct {
+    DiagnosticCode code;
+    DiagnosticId id;
+    int position; // start position in expression
+    int length; // length of the offending text
+} Diagnostic;
+
+typedef enum {
+    DIAGNOSTICS_PRINT, // also write each diagnostic to stderr when reported
+    DIAGNOSTICS_COLLECT // only record, format with print_diagnostics()
+} DiagnosticsMode;
+
+typedef struct Diagnostics {
+    Diagnostic *items;
+    int size;
+    int capacity;
+    DiagnosticsMode mode;
+    const char *expression; // text the positions refer to
+} Diagnostics;
+
+Diagnostics *create_diagnostics(DiagnosticsMode mode);
+void free_diagnostics(Diagnostics *diagnostics);
+
+// Forget previous diagnostics, positions now refer to expression
+void reset_diagnostics(Diagnostics *diagnostics, const char *expression);
+
+// Record a diagnostic, a NULL diagnostics buffer discards it
+void report_diagnostic(Diagnostics *diagnostics, DiagnosticId id,
+    int position, int length);
+
+// Format like snprintf(), without the trailing newline
+int format_diagnostic(const Diagnostics *diagnostics,
+    const Diagnostic *diagnostic, char *buffer, size_t size);
+
+// Write all diagnostics to stream with a single write
+void print_diagnostics(const Diagnostics *diagnostics, FILE *stream);
+
+#endif
@@ -0,0 +1,312 @@
+#include "Jit.h"
+#include "RegisterCode.h"
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define HAVE_JIT 1
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_JIT
+
+// Machine code in a growing buffer, the pool follows the code when mapped:
+// the sign mask for negation at offset 0, then the constants
+typedef struct Emitter {
+    uint8_t *code;
+    size_t size;
+    size_t capacity;
+    size_t *fixups; // rip relative displacements to patch
+    int32_t *targets; // their offsets in the pool
+    size_t fixup_count;
+    size_t fixup_capacity;
+    int first_constant; // register of constant 0
+    int cached; // register held in xmm0, -1 if none
+} Emitter;
+
+#define POOL_ALIGN 16
+#define SIGN_MASK -1 // pool target of the sign mask
+
+// Encodings
+#define PREFIX_SD 0xF2 // scalar double
+#define PREFIX_PD 0x66 // packed double
+#define OP_MOVSD_LOAD 0x10
+#define OP_MOVSD_STORE 0x11
+#define OP_MOVAPD 0x28
+#define OP_XORPD 0x57
+#define OP_ADDSD 0x58
+#define OP_MULSD 0x59
+#define OP_SUBSD 0x5C
+#define OP_DIVSD 0x5E
+#define REG_BASE 3 // rbx holds the registers array, it's kept across calls
+
+static void emit(Emitter *e, const uint8_t *bytes, size_t size)
+{
+    if (e->size + size > e->capacity) {
+        e->capacity = 2 * e->capacity + size;
+        e->code = (uint8_t *)realloc(e->code, e->capacity);
+        assert(e->code != NULL);
+    }
+    memcpy(e->code + e->size, bytes, size);
+    e->size += size;
+}
+
+static void emit_byte(Emitter *e, uint8_t byte)
+{
+    emit(e, &byte, 1);
+}
+
+static void emit_int32(Emitter *e, int32_t value)
+{
+    uint8_t bytes[4];
+    for (int i = 0; i < 4; i++)
+        bytes[i] = (uint8_t)((uint32_t)value >> (8 * i));
+    emit(e, bytes, 4);
+}
+
+static void add_fixup(Emitter *e, int32_t target)
+{
+    if (e->fixup_count == e->fixup_capacity) {
+        e->fixup_capacity = 2 * e->fixup_capacity + 16;
+        e->fixups = (size_t *)realloc(e->fixups, e->fixup_capacity * sizeof(size_t));
+        e->targets = (int32_t *)realloc(e->targets, e->fixup_capacity * sizeof(int32_t));
+        assert(e->fixups != NULL && e->targets != NULL);
+    }
+    e->fixups[e->fixup_count] = e->size;
+    e->targets[e->fixup_count] = target;
+    e->fixup_count++;
+    emit_int32(e, 0);
+}
+
+// op xmm, [register]: ans and temporaries at [rbx + 8 * register], the
+// constants and the sign mask rip relative in the pool
+static void emit_memory(Emitter *e, uint8_t prefix, uint8_t op, int xmm, int reg)
+{
+    uint8_t bytes[] = { prefix, 0x0F, op };
+    emit(e, bytes, sizeof(bytes));
+    if (reg == SIGN_MASK || reg >= e->first_constant) {
+        emit_byte(e, (uint8_t)(0x05 | xmm << 3)); // [rip + disp32]
+        add_fixup(e, reg == SIGN_MASK ? 0 : POOL_ALIGN + 8 * (reg - e->first_constant));
+    } else {
+        emit_byte(e, (uint8_t)(0x80 | xmm << 3 | REG_BASE)); // [rbx + disp32]
+        emit_int32(e, 8 * reg);
+    }
+}
+
+// op xmm, xmm
+static void emit_register(Emitter *e, uint8_t prefix, uint8_t op, int dst, int src)
+{
+    uint8_t bytes[] = { prefix, 0x0F, op, (uint8_t)(0xC0 | dst << 3 | src) };
+    emit(e, bytes, sizeof(bytes));
+}
+
+static void load(Emitter *e, int reg)
+{
+    if (e->cached != reg)
+        emit_memory(e, PREFIX_SD, OP_MOVSD_LOAD, 0, reg);
+    e->cached = reg;
+}
+
+// Every result is stored, xmm0 still holds it
+static void store(Emitter *e, int reg)
+{
+    emit_memory(e, PREFIX_SD, OP_MOVSD_STORE, 0, reg);
+    e->cached = reg;
+}
+
+// The stack is 16 byte aligned after the push of rbx
+static void emit_call(Emitter *e, uint64_t address)
+{
+    uint8_t bytes[] = { 0x48, 0xB8 }; // mov rax, imm64
+    emit(e, bytes, sizeof(bytes));
+    for (int i = 0; i < 8; i++)
+        emit_byte(e, (uint8_t)(address >> (8 * i)));
+    uint8_t call[] = { 0xFF, 0xD0 }; // call rax
+    emit(e, call, sizeof(call));
+}
+
+static const uint8_t arithmetic[] = {
+    OP_ADDSD, // REG_ADD
+    OP_SUBSD, // REG_SUB
+    OP_MULSD, // REG_MUL
+    OP_DIVSD, // REG_DIV
+};
+
+// The operations and their order are those of run_register_code(), so the
+// results are the same bit for bit
+static void emit_instruction(Emitter *e, const RegisterCode *code, const RegisterInstruction *ip)
+{
+    switch (ip->op) {
+    case REG_NEG:
+        load(e, ip->a);
+        emit_memory(e, PREFIX_PD, OP_XORPD, 0, SIGN_MASK);
+        break;
+    case REG_ADD:
+    case REG_SUB:
+    case REG_MUL:
+    case REG_DIV:
+        load(e, ip->a);
+        emit_memory(e, PREFIX_SD, arithmetic[ip->op - REG_ADD], 0, ip->b);
+        break;
+    case REG_POW:
+        load(e, ip->a);
+        emit_memory(e, PREFIX_SD, OP_MOVSD_LOAD, 1, ip->b);
+        emit_call(e, (uintptr_t)pow);
+        break;
+    case REG_SQUARE:
+        load(e, ip->a);
+        emit_register(e, PREFIX_SD, OP_MULSD, 0, 0);
+        break;
+    case REG_CALL:
+        load(e, ip->a);
+        emit_call(e, (uintptr_t)code->functions[ip->c]);
+        break;
+    case REG_MUL_ADD:
+    case REG_MUL_SUB:
+        load(e, ip->a);
+        emit_memory(e, PREFIX_SD, OP_MULSD, 0, ip->b);
+        emit_memory(e, PREFIX_SD, ip->op == REG_MUL_ADD ? OP_ADDSD : OP_SUBSD, 0, ip->c);
+        break;
+    case REG_ADD_MUL:
+    case REG_SUB_MUL:
+        // c first: xmm1 = c op (a * b)
+        emit_memory(e, PREFIX_SD, OP_MOVSD_LOAD, 1, ip->c);
+        load(e, ip->a);
+        emit_memory(e, PREFIX_SD, OP_MULSD, 0, ip->b);
+        emit_register(e, PREFIX_SD, ip->op == REG_ADD_MUL ? OP_ADDSD : OP_SUBSD, 1, 0);
+        emit_register(e, PREFIX_PD, OP_MOVAPD, 0, 1);
+        break;
+    case REG_CALL_ADD:
+    case REG_CALL_SUB:
+    case REG_CALL_MUL:
+    case REG_CALL_DIV:
+        load(e, ip->a);
+        emit_memory(e, PREFIX_SD, arithmetic[ip->op - REG_CALL_ADD], 0, ip->b);
+        emit_call(e, (uintptr_t)code->functions[ip->c]);
+        break;
+    default:
+        assert(0 && "not a register opcode");
+    }
+    store(e, ip->dst);
+}
+
+static void emit_function(Emitter *e, const RegisterCode *code)
+{
+    static const uint8_t prologue[] = {
+        0x53, // push rbx
+        0x48, 0x89, 0xFB, // mov rbx, rdi
+    };
+    emit(e, prologue, sizeof(prologue));
+    store(e, 0); // ans
+
+    for (int i = 0; i < code->size; i++)
+        emit_instruction(e, code, &code->code[i]);
+
+    load(e, code->result);
+    static const uint8_t epilogue[] = {
+        0x5B, // pop rbx
+        0xC3, // ret
+    };
+    emit(e, epilogue, sizeof(epilogue));
+}
+
+// Map the code and the pool, patch the displacements and make the pages
+// executable
+static JitCode *map_code(Emitter *e, const RegisterCode *code)
+{
+    size_t pool = (e->size + POOL_ALIGN - 1) / POOL_ALIGN * POOL_ALIGN;
+    size_t size = pool + POOL_ALIGN + code->constant_count * sizeof(double);
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return NULL;
+
+    uint8_t *bytes = (uint8_t *)memory;
+    memcpy(bytes, e->code, e->size);
+    memset(bytes + e->size, 0xCC, pool - e->size); // int3
+    for (size_t i = 0; i < e->fixup_count; i++) {
+        // Relative to the end of the instruction, the displacement is last
+        int64_t displacement = (int64_t)(pool + e->targets[i]) - (int64_t)(e->fixups[i] + 4);
+        int32_t value = (int32_t)displacement;
+        memcpy(bytes + e->fixups[i], &value, sizeof(value));
+    }
+    uint64_t sign[2] = { UINT64_C(1) << 63, 0 };
+    memcpy(bytes + pool, sign, sizeof(sign));
+    if (code->constant_count > 0)
+        memcpy(bytes + pool + POOL_ALIGN, code->constants, code->constant_count * sizeof(double));
+
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return NULL;
+    }
+
+    JitCode *jit = (JitCode *)malloc(sizeof(JitCode));
+    assert(jit != NULL);
+    jit->function = (JitFunction)memory;
+    jit->memory = memory;
+    jit->size = size;
+    jit->registers = 1 + code->temporaries;
+    return jit;
+}
+
+JitCode *compile_jit(const Ast *ast)
+{
+    RegisterCode *code = compile_register_code(ast);
+    // Displacements are 32 bit
+    if ((size_t)code->size > INT32_MAX / 64 || code->constant_count > INT32_MAX / 16) {
+        free_register_code(code);
+        return NULL;
+    }
+
+    Emitter e = { 0 };
+    e.first_constant = 1 + code->temporaries;
+    e.cached = -1;
+    emit_function(&e, code);
+    JitCode *jit = map_code(&e, code);
+
+    free(e.code);
+    free(e.fixups);
+    free(e.targets);
+    free_register_code(code);
+    return jit;
+}
+
+void free_jit(JitCode *jit)
+{
+    if (jit == NULL)
+        return;
+    munmap(jit->memory, jit->size);
+    free(jit);
+}
+
+double run_jit(const JitCode *jit, double ans, double *registers)
+{
+    return jit->function(ans, registers);
+}
+
+#else // no JIT
+
+JitCode *compile_jit(const Ast *ast)
+{
+    (void)ast;
+    return NULL;
+}
+
+void free_jit(JitCode *jit)
+{
+    (void)jit;
+    assert(jit == NULL);
+}
+
+double run_jit(const JitCode *jit, double ans, double *registers)
+{
+    (void)jit;
+    (void)ans;
+    (void)registers;
+    assert(0 && "no JIT");
+    return NAN;
+}
+
+#endif // HAVE_JIT
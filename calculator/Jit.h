@@ -0,0 +1,34 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "Parser.h"
+#include <stddef.h>
+
+// A parsed expression compiled to x86-64 machine code. The register code
+// of RegisterCode.h is translated instruction by instruction to scalar
+// SSE2: arithmetic is inline, builtins and pow are called in libm, ans and
+// the temporaries live in the registers array the caller passes in and
+// the constants in a pool after the code. Pages are mapped writable, then
+// made executable. Each program has pages of its own, so the JIT pays off
+// for a formula evaluated many times rather than many formulas once each.
+//
+// Only available on x86-64 with the System V calling convention, elsewhere
+// compile_jit() returns NULL and the interpreter is used.
+
+typedef double (*JitFunction)(double ans, double *registers);
+
+typedef struct JitCode {
+    JitFunction function;
+    void *memory; // mapped pages
+    size_t size;
+    int registers; // doubles the registers array needs
+} JitCode;
+
+// Compile a well formed tree, NULL where there is no JIT or the pages
+// can't be mapped
+JitCode *compile_jit(const Ast *ast);
+void free_jit(JitCode *jit);
+
+double run_jit(const JitCode *jit, double ans, double *registers);
+
+#endif // JIT_H
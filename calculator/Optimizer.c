@@ -0,0 +1,251 @@
+#include "Optimizer.h"
+#include "Symbol.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Folding {
+    double value; // of a constant subtree
+    int start; // text of the subtree
+    int end;
+    int constant;
+} Folding;
+
+// The operations of perform_operation()
+static double fold_operation(const AstNode *node, double left, double right)
+{
+    int is_unary = node->child[1] == AST_NONE;
+    switch (node->token.type) {
+    case PLUS:
+        return is_unary ? left : left + right;
+    case MINUS:
+        return is_unary ? -left : left - right;
+    case MULT:
+        return left * right;
+    case DIV:
+        return left / right;
+    case POW:
+        return pow(left, right);
+    default:
+        assert(0 && "not an operator");
+    }
+    return 0.0;
+}
+
+static int is_literal(const AstNode *node)
+{
+    return node->token.type == FLOAT || node->token.type == INTEGER;
+}
+
+// Drop the nodes the root doesn't reach, in place. Children come first, so
+// marking downwards from the root is one backward pass and the nodes that
+// are kept stay in post-order.
+static void drop_unreachable(Ast *ast)
+{
+    int size = ast->root + 1;
+    int32_t *index = (int32_t *)malloc(size * sizeof(int32_t));
+    assert(index != NULL);
+    for (int i = 0; i < size; i++)
+        index[i] = AST_NONE;
+    index[ast->root] = 0;
+    for (int i = ast->root; i >= 0; i--) {
+        if (index[i] == AST_NONE)
+            continue;
+        for (int k = 0; k < 2; k++) {
+            if (ast->nodes[i].child[k] != AST_NONE)
+                index[ast->nodes[i].child[k]] = 0;
+        }
+    }
+
+    int count = 0;
+    for (int i = 0; i < size; i++) {
+        if (index[i] == AST_NONE)
+            continue;
+        AstNode node = ast->nodes[i];
+        for (int k = 0; k < 2; k++) {
+            if (node.child[k] != AST_NONE)
+                node.child[k] = index[node.child[k]];
+        }
+        index[i] = count;
+        ast->nodes[count++] = node;
+    }
+    ast->size = count;
+    ast->root = count - 1;
+    free(index);
+}
+
+void fold_constants(Ast *ast)
+{
+    if (ast->root == AST_NONE)
+        return;
+    int size = ast->root + 1;
+    Folding *folding = (Folding *)malloc(size * sizeof(Folding));
+    assert(folding != NULL);
+
+    // Children come first, their values are known for the parent. A folded
+    // node becomes a literal in place, its operands are dropped after.
+    int folds = 0;
+    for (int i = 0; i < size; i++) {
+        AstNode *node = &ast->nodes[i];
+        Folding *f = &folding[i];
+        f->start = node->token.position;
+        f->end = node->token.position + node->token.length;
+        f->constant = 1;
+        for (int k = 0; k < 2; k++) {
+            int child = node->child[k];
+            if (child == AST_NONE)
+                continue;
+            if (f->start > folding[child].start)
+                f->start = folding[child].start;
+            if (f->end < folding[child].end)
+                f->end = folding[child].end;
+            f->constant = f->constant && folding[child].constant;
+        }
+
+        if (is_literal(node)) {
+            f->value = node->token.number;
+            continue;
+        } else if (node->token.type == ID) {
+            const Symbol *symbol = get_symbol(node->token.symbol);
+            f->constant = f->constant && symbol->pure;
+            if (!f->constant) { // ans, or an operand depends on it
+                continue;
+            } else if (node->child[0] != AST_NONE) { // function call
+                f->value = symbol->function(folding[node->child[0]].value);
+            } else {
+                f->value = symbol->value;
+            }
+        } else if (f->constant) {
+            double right = node->child[1] != AST_NONE ? folding[node->child[1]].value : 0.0;
+            f->value = fold_operation(node, folding[node->child[0]].value, right);
+        }
+
+        if (f->constant) {
+            node->token = create_token(FLOAT, f->start, f->end - f->start);
+            node->token.number = f->value;
+            node->child[0] = node->child[1] = AST_NONE;
+            folds++;
+        }
+    }
+    free(folding);
+    if (folds > 0)
+        drop_unreachable(ast);
+}
+
+// Fast math rewrites, the tree is rebuilt node by node: map[i] is the node
+// of the new tree old node i became
+
+static int literal_is(const Ast *ast, int index, double value)
+{
+    return is_literal(&ast->nodes[index]) && ast->nodes[index].token.number == value;
+}
+
+static int add_literal(Ast *ast, const Token *at, double value)
+{
+    Token token = create_token(FLOAT, at->position, at->length);
+    token.number = value;
+    return add_ast_node(ast, &token, AST_NONE, AST_NONE);
+}
+
+static int add_operation(Ast *ast, const Token *at, TokenType type, int left, int right)
+{
+    Token token = *at;
+    token.type = type;
+    return add_ast_node(ast, &token, left, right);
+}
+
+// base^n for 0 < n by squaring, base^13 is base * base^4 * base^8
+static int add_power(Ast *ast, const Token *at, int base, int n)
+{
+    int result = AST_NONE;
+    for (;;) {
+        if (n & 1)
+            result = result == AST_NONE ? base : add_operation(ast, at, MULT, result, base);
+        n >>= 1;
+        if (n == 0)
+            return result;
+        base = add_operation(ast, at, MULT, base, base);
+    }
+}
+
+static int rewrite_power(Ast *ast, const Token *at, int base, int exponent)
+{
+    double n = ast->nodes[exponent].token.number;
+    if (n == 0.5) {
+        Token token = *at;
+        token.type = ID;
+        token.symbol = intern_symbol("sqrt", 4);
+        return add_ast_node(ast, &token, base, AST_NONE);
+    }
+    if (n != floor(n) || fabs(n) > FAST_MATH_MAX_POWER)
+        return add_operation(ast, at, POW, base, exponent);
+    if (n == 0)
+        return add_literal(ast, at, 1.0);
+    int power = add_power(ast, at, base, (int)fabs(n));
+    if (n < 0)
+        return add_operation(ast, at, DIV, add_literal(ast, at, 1.0), power);
+    return power;
+}
+
+void rewrite_fast_math(Ast *ast)
+{
+    if (ast->root == AST_NONE)
+        return;
+    int size = ast->root + 1;
+    int32_t *map = (int32_t *)malloc(size * sizeof(int32_t));
+    assert(map != NULL);
+    Ast *out = create_ast(NULL);
+    reserve_ast(out, size);
+
+    for (int i = 0; i < size; i++) {
+        const AstNode *node = &ast->nodes[i];
+        const Token *at = &node->token;
+        int left = node->child[0] != AST_NONE ? map[node->child[0]] : AST_NONE;
+        int right = node->child[1] != AST_NONE ? map[node->child[1]] : AST_NONE;
+        int index = AST_NONE;
+        switch (at->type) {
+        case PLUS:
+            if (right == AST_NONE || literal_is(out, right, 0.0)) // +x, x+0
+                index = left;
+            else if (literal_is(out, left, 0.0)) // 0+x
+                index = right;
+            break;
+        case MINUS:
+            if (right != AST_NONE && literal_is(out, right, 0.0)) // x-0
+                index = left;
+            break;
+        case MULT:
+            if (literal_is(out, right, 1.0)) // x*1
+                index = left;
+            else if (literal_is(out, left, 1.0)) // 1*x
+                index = right;
+            break;
+        case DIV:
+            if (literal_is(out, right, 1.0)) // x/1
+                index = left;
+            else if (is_literal(&out->nodes[right])) // x/c is x*(1/c)
+                index = add_operation(out, at, MULT, left,
+                    add_literal(out, &out->nodes[right].token, 1.0 / out->nodes[right].token.number));
+            break;
+        case POW:
+            if (literal_is(out, right, 1.0)) // x^1
+                index = left;
+            else if (is_literal(&out->nodes[right]))
+                index = rewrite_power(out, at, left, right);
+            break;
+        default:
+            break;
+        }
+        map[i] = index != AST_NONE ? index : add_ast_node(out, at, left, right);
+    }
+
+    // Back into the tree, the operands that were rewritten away are dropped
+    reserve_ast(ast, out->size);
+    memcpy(ast->nodes, out->nodes, out->size * sizeof(AstNode));
+    ast->size = out->size;
+    ast->root = map[size - 1];
+    drop_unreachable(ast);
+    free_ast(out);
+    free(map);
+}
@@ -0,0 +1,32 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "Parser.h"
+
+// Rewrites of a parsed tree, run between parse() and evaluation.
+//
+// fold_constants() replaces every subtree of literals and pure symbols
+// (Symbol.pure, all but ans), such as 2*pi/360 or sqrt(2)/2, by a literal
+// of its value spanning the text of the subtree. Values are computed with
+// the operations of eval(), so the results are the same bit for bit, NaN,
+// inf and signed zero included. Nodes no longer reachable are dropped,
+// the order stays post-order and a DAG stays a DAG.
+
+void fold_constants(Ast *ast);
+
+// rewrite_fast_math() trades exact IEEE results for speed, with literal
+// operands after fold_constants():
+//   x^n        multiplications by squaring, 1/x^-n for negative n,
+//              for integer n up to FAST_MATH_MAX_POWER
+//   x^0.5      sqrt(x), differs for -0 and -inf
+//   x/c        x*(1/c), the reciprocal is rounded
+//   +x, x+0, 0+x, x-0, x*1, 1*x, x/1, x^1 as x and x^0 as 1, -0+0 then
+//              stays -0
+// Operands are shared rather than copied, x^4 is one x*x used twice, so
+// the tree becomes a DAG and every engine computes a shared node once.
+
+#define FAST_MATH_MAX_POWER 64
+
+void rewrite_fast_math(Ast *ast);
+
+#endif // OPTIMIZER_H
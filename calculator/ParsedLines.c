@@ -0,0 +1,277 @@
+#include "ParsedLines.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+#endif
+
+#define CHUNKS_PER_THREAD 8 // smaller chunks even out long and short lines
+#define MIN_CHUNK_SIZE (64 * 1024)
+#define WORKER_ARENA_SIZE (1024 * 1024)
+#define WORKER_SCRATCH_SIZE (64 * 1024)
+
+// Whole lines [begin, end), parsed by one worker
+typedef struct Chunk {
+    const char *begin;
+    const char *end;
+    ParsedLine *lines;
+    int count;
+} Chunk;
+
+// Chunks are handed out in order to whichever worker asks first
+typedef struct Pool {
+    Chunk *chunks;
+    int count;
+    int next;
+    Mutex lock;
+} Pool;
+
+typedef struct Worker {
+    Pool *pool;
+    Arena *arena; // results, outlives the worker
+    Thread thread;
+} Worker;
+
+static void *copy_to_arena(Arena *arena, const void *data, size_t size)
+{
+    void *copy = arena_alloc(arena, size);
+    if (size > 0) // data may be NULL then
+        memcpy(copy, data, size);
+    return copy;
+}
+
+// The parser's AST and diagnostics are reused by the next line, keep a copy
+static void parse_line(ParsedLine *line, const char *begin, int length,
+    Parser *parser, Diagnostics *diagnostics, Arena *arena)
+{
+    reset_diagnostics(diagnostics, begin);
+    reset_parser(parser, begin, length);
+    parse(parser);
+
+    const Ast *ast = parser->ast;
+    int size = ast->root + 1;
+    line->expression = begin;
+    line->length = length;
+    line->status = parser->status;
+    line->ast.nodes = (AstNode *)copy_to_arena(arena, ast->nodes, size * sizeof(AstNode));
+    line->ast.size = size;
+    line->ast.capacity = size;
+    line->ast.arena = arena;
+    line->ast.root = ast->root;
+    line->diagnostics.items = (Diagnostic *)copy_to_arena(arena, diagnostics->items,
+        diagnostics->size * sizeof(Diagnostic));
+    line->diagnostics.size = diagnostics->size;
+    line->diagnostics.capacity = diagnostics->size;
+    line->diagnostics.mode = DIAGNOSTICS_COLLECT;
+    line->diagnostics.expression = begin;
+}
+
+static void parse_chunk(Chunk *chunk, Parser *parser, Diagnostics *diagnostics, Arena *arena)
+{
+    int count = 0;
+    for (const char *p = chunk->begin; p < chunk->end; count++) {
+        const char *newline = (const char *)memchr(p, '\n', chunk->end - p);
+        p = newline ? newline + 1 : chunk->end;
+    }
+
+    chunk->lines = (ParsedLine *)arena_alloc(arena, count * sizeof(ParsedLine));
+    chunk->count = count;
+    const char *p = chunk->begin;
+    for (int i = 0; i < count; i++) {
+        const char *newline = (const char *)memchr(p, '\n', chunk->end - p);
+        const char *end = newline ? newline : chunk->end;
+        parse_line(&chunk->lines[i], p, (int)(end - p), parser, diagnostics, arena);
+        p = newline ? newline + 1 : chunk->end;
+    }
+}
+
+static Chunk *next_chunk(Pool *pool)
+{
+    Chunk *chunk = NULL;
+#ifdef _WIN32
+    EnterCriticalSection(&pool->lock);
+#else
+    pthread_mutex_lock(&pool->lock);
+#endif
+    if (pool->next < pool->count)
+        chunk = &pool->chunks[pool->next++];
+#ifdef _WIN32
+    LeaveCriticalSection(&pool->lock);
+#else
+    pthread_mutex_unlock(&pool->lock);
+#endif
+    return chunk;
+}
+
+// A parser of its own in a scratch arena, results go to the worker arena
+static void run_worker(Worker *worker)
+{
+    Arena *scratch = create_arena(WORKER_SCRATCH_SIZE);
+    Diagnostics *diagnostics = create_diagnostics(DIAGNOSTICS_COLLECT);
+    Parser *parser = create_parser("", PARSE_BATCH, diagnostics, scratch);
+    Chunk *chunk;
+    while ((chunk = next_chunk(worker->pool)) != NULL)
+        parse_chunk(chunk, parser, diagnostics, worker->arena);
+    free_diagnostics(diagnostics);
+    free_arena(scratch); // parser included
+}
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID worker)
+{
+    run_worker((Worker *)worker);
+    return 0;
+}
+
+static void start_worker(Worker *worker)
+{
+    worker->thread = CreateThread(NULL, 0, thread_main, worker, 0, NULL);
+    assert(worker->thread != NULL);
+}
+
+static void join_worker(Worker *worker)
+{
+    WaitForSingleObject(worker->thread, INFINITE);
+    CloseHandle(worker->thread);
+}
+
+static int core_count()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+#else
+static void *thread_main(void *worker)
+{
+    run_worker((Worker *)worker);
+    return NULL;
+}
+
+static void start_worker(Worker *worker)
+{
+    int error = pthread_create(&worker->thread, NULL, thread_main, worker);
+    assert(error == 0);
+    (void)error;
+}
+
+static void join_worker(Worker *worker)
+{
+    pthread_join(worker->thread, NULL);
+}
+
+static int core_count()
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (int)count : 1;
+}
+#endif
+
+// Cut roughly equal chunks, each extended to the end of its last line
+static void split_chunks(Pool *pool, const char *input, size_t length, int threads)
+{
+    size_t target = length / ((size_t)threads * CHUNKS_PER_THREAD);
+    if (target < MIN_CHUNK_SIZE)
+        target = MIN_CHUNK_SIZE;
+
+    int capacity = (int)(length / target) + 1;
+    pool->chunks = (Chunk *)malloc(capacity * sizeof(Chunk));
+    assert(pool->chunks != NULL);
+    pool->count = 0;
+    pool->next = 0;
+    size_t begin = 0;
+    while (begin < length) {
+        size_t end = length;
+        if (length - begin > target) {
+            const char *newline = (const char *)memchr(input + begin + target, '\n',
+                length - begin - target);
+            end = newline ? (size_t)(newline - input) + 1 : length;
+        }
+        assert(pool->count < capacity);
+        Chunk *chunk = &pool->chunks[pool->count++];
+        chunk->begin = input + begin;
+        chunk->end = input + end;
+        chunk->lines = NULL;
+        chunk->count = 0;
+        begin = end;
+    }
+}
+
+ParsedLines *parse_lines(const char *input, size_t length, int threads)
+{
+    if (threads <= 0)
+        threads = core_count();
+
+    Pool pool;
+    split_chunks(&pool, input, length, threads);
+    if (threads > pool.count)
+        threads = pool.count;
+
+    ParsedLines *parsed = (ParsedLines *)calloc(1, sizeof(ParsedLines));
+    assert(parsed != NULL);
+    if (threads <= 0) { // empty input
+        free(pool.chunks);
+        return parsed;
+    }
+
+    parsed->arenas = (Arena **)malloc((size_t)threads * sizeof(Arena *));
+    Worker *workers = (Worker *)malloc((size_t)threads * sizeof(Worker));
+    assert(parsed->arenas != NULL && workers != NULL);
+    parsed->arena_count = threads;
+#ifdef _WIN32
+    InitializeCriticalSection(&pool.lock);
+#else
+    pthread_mutex_init(&pool.lock, NULL);
+#endif
+    for (int i = 0; i < threads; i++) {
+        workers[i].pool = &pool;
+        workers[i].arena = parsed->arenas[i] = create_arena(WORKER_ARENA_SIZE);
+    }
+
+    // The calling thread is worker 0
+    for (int i = 1; i < threads; i++)
+        start_worker(&workers[i]);
+    run_worker(&workers[0]);
+    for (int i = 1; i < threads; i++)
+        join_worker(&workers[i]);
+#ifdef _WIN32
+    DeleteCriticalSection(&pool.lock);
+#else
+    pthread_mutex_destroy(&pool.lock);
+#endif
+
+    // Merge in input order
+    for (int i = 0; i < pool.count; i++)
+        parsed->count += pool.chunks[i].count;
+    parsed->lines = (ParsedLine *)malloc(parsed->count * sizeof(ParsedLine));
+    assert(parsed->lines != NULL);
+    ParsedLine *line = parsed->lines;
+    for (int i = 0; i < pool.count; i++) {
+        memcpy(line, pool.chunks[i].lines, pool.chunks[i].count * sizeof(ParsedLine));
+        line += pool.chunks[i].count;
+    }
+
+    free(workers);
+    free(pool.chunks);
+    return parsed;
+}
+
+void free_parsed_lines(ParsedLines *parsed)
+{
+    if (parsed) {
+        for (int i = 0; i < parsed->arena_count; i++)
+            free_arena(parsed->arenas[i]);
+        free(parsed->arenas);
+        free(parsed->lines);
+    }
+    free(parsed);
+}
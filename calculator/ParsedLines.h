@@ -0,0 +1,33 @@
+#ifndef PARSED_LINES_H
+#define PARSED_LINES_H
+
+#include "Arena.h"
+#include "Diagnostics.h"
+#include "Parser.h"
+#include <stddef.h>
+
+// Input with one independent expression per line, parsed in parallel:
+// the text is split into chunks at line boundaries, worker threads parse
+// whole chunks into their own arenas and the lines are merged in order.
+
+typedef struct ParsedLine {
+    const char *expression; // the line in the input, without its newline
+    int length;
+    int status; // parser status, 1 for success
+    Ast ast; // view into a worker arena, don't free_ast() it
+    Diagnostics diagnostics; // errors of the line, for print_diagnostics()
+} ParsedLine;
+
+typedef struct ParsedLines {
+    ParsedLine *lines; // in input order
+    int count;
+    Arena **arenas; // one per worker, owns the ASTs and diagnostics
+    int arena_count;
+} ParsedLines;
+
+// Parse every line of the length characters at input, which must stay
+// alive as long as the result. threads <= 0 uses one thread per core.
+ParsedLines *parse_lines(const char *input, size_t length, int threads);
+void free_parsed_lines(ParsedLines *parsed);
+
+#endif // PARSED_LINES_H
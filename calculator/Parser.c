@@ -1,17 +1,40 @@
 #include "Parser.h"
+#include "Symbol.h"
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Binding powers, a higher one binds tighter
+typedef enum {
+    BP_NONE,
+    BP_SUM, // + -
+    BP_PRODUCT, // * /
+    BP_UNARY, // prefix + -
+    BP_POWER // ^
+} BindingPower;
+
+// Token sets as bitmasks, membership is a single AND
+typedef unsigned TokenSet;
+#define TOKEN_BIT(type) (1u << (type))
+
+// FOLLOW sets, a level is followed by the operators of the levels above
+// it. FIRST(expr) is the prefix column of rules[], also a single lookup.
+#define FOLLOW_EXPR (TOKEN_BIT(RPAREN) | TOKEN_BIT(EOL))
+#define FOLLOW_TERM (FOLLOW_EXPR | TOKEN_BIT(PLUS) | TOKEN_BIT(MINUS))
+#define FOLLOW_UNARY (FOLLOW_TERM | TOKEN_BIT(MULT) | TOKEN_BIT(DIV) | TOKEN_BIT(POW))
+
 // Declarations
+void fill_lookahead(Parser *parser, int n);
+Token *current_token(Parser *parser);
+Token *peek_token(Parser *parser);
 void advance(Parser *parser);
 int expect_token(Parser *parser, TokenType expected);
-void report_error(Parser *parser, const char *msg);
-AstNode *parse_expr(Parser *parser, int level);
-AstNode *parse_term(Parser *parser, int level);
-AstNode *parse_power(Parser *parser, int level);
-AstNode *parse_unary(Parser *parser, int level);
-AstNode *parse_factor(Parser *parser, int level);
+void report_error(Parser *parser, DiagnosticId id);
+int is_builtin(const Token *token, SymbolKind kind);
+void report_unknown_name(Parser *parser, const Token *token, DiagnosticId id);
+int parse_expr(Parser *parser, BindingPower rbp);
+void reset_cons(Parser *parser, int nodes);
 
 #ifdef DEBUG
 
@@ -21,94 +44,138 @@ void debug(const char *fn, Parser *parser, int level)
         printf("  ");
     }
     printf("CALL %-14s:", fn);
-    if (parser->curr) {
-        printf("{type:%-7s, literal:%s}\n",
-            TokenName[parser->curr->token->type],
-            parser->curr->token->literal);
-    } else {
-        printf("NULL\n");
-    }
+    Token *token = current_token(parser);
+    printf("{type:%-7s, literal:%.*s}\n", TokenName[token->type],
+        token->length, parser->expression + token->position);
 }
 
 #endif
 
-// Create a AST node
-AstNode *create_ast_node(Token *token)
+#define AST_INIT_CAPACITY 16
+
+Ast *create_ast(Arena *arena)
 {
-    AstNode *node = (AstNode *)malloc(sizeof(AstNode));
-    if (node == NULL) {
-        printf("Allocation failed!\n");
-        return NULL;
-    }
-    node->token = token;
-    node->firstChild = NULL;
-    node->nextSibling = NULL;
-    return node;
+    Ast *ast = (Ast *)arena_alloc(arena, sizeof(Ast));
+    ast->nodes = (AstNode *)arena_alloc(arena, AST_INIT_CAPACITY * sizeof(AstNode));
+    ast->arena = arena;
+    ast->size = 0;
+    ast->capacity = AST_INIT_CAPACITY;
+    ast->root = AST_NONE;
+    return ast;
 }
 
-// Append a child to parent's child list
-void add_child(AstNode *parent, AstNode *child)
+void reserve_ast(Ast *ast, int size)
 {
-    if (parent == NULL) {
+    if (size <= ast->capacity)
         return;
-    }
+    int capacity = ast->capacity * 2;
+    while (capacity < size)
+        capacity *= 2;
+    ast->nodes = (AstNode *)arena_realloc(ast->arena, ast->nodes,
+        ast->capacity * sizeof(AstNode), capacity * sizeof(AstNode));
+    ast->capacity = capacity;
+}
 
-    if (parent->firstChild == NULL) {
-        parent->firstChild = child;
-    } else {
-        // Append the right most
-        AstNode *sibling = parent->firstChild;
-        while (sibling->nextSibling != NULL) {
-            sibling = sibling->nextSibling;
-        }
-        sibling->nextSibling = child;
-    }
+// Children must already be in the array
+int add_ast_node(Ast *ast, const Token *token, int left, int right)
+{
+    reserve_ast(ast, ast->size + 1);
+    AstNode *node = &ast->nodes[ast->size];
+    node->token = *token;
+    node->child[0] = left;
+    node->child[1] = right;
+    return ast->size++;
 }
 
-// Postorder print
-void print_ast(AstNode *root)
+// Postorder print, nodes abandoned by error recovery are skipped
+void print_ast(const char *expression, const Ast *ast)
 {
-    if (root == NULL) {
+    if (ast == NULL || ast->root == AST_NONE) {
         return;
     }
 
-    // Print all children
-    AstNode *child = root->firstChild;
-    while (child != NULL) {
-        print_ast(child); // recursively
-        child = child->nextSibling;
+    // Children come before their parent, marking downwards from the root
+    // finds every node of the tree, the array order is then postorder
+    char *reachable = (char *)calloc(ast->root + 1, 1);
+    assert(reachable != NULL);
+    reachable[ast->root] = 1;
+    for (int i = ast->root; i >= 0; i--) {
+        if (!reachable[i])
+            continue;
+        for (int k = 0; k < 2; k++) {
+            if (ast->nodes[i].child[k] != AST_NONE)
+                reachable[ast->nodes[i].child[k]] = 1;
+        }
     }
-    printf("%s ", root->token->literal); // vist parent
+
+    for (int i = 0; i <= ast->root; i++) {
+        const AstNode *node = &ast->nodes[i];
+        if (reachable[i])
+            printf("%.*s ", node->token.length, expression + node->token.position);
+    }
+    free(reachable);
 }
 
 // Destroy AST
-void free_ast(AstNode *ast)
+void free_ast(Ast *ast)
 {
-    if (ast) {
-        // Destroy recursively
-        free_ast(ast->firstChild);
-        free_ast(ast->nextSibling);
-        free(ast);
-    }
+    if (ast == NULL)
+        return;
+    arena_free(ast->arena, ast->nodes);
+    arena_free(ast->arena, ast);
+}
+
+Parser *create_parser(const char *expression, ParseMode mode,
+    Diagnostics *diagnostics, Arena *arena)
+{
+    Parser *parser = (Parser *)arena_alloc(arena, sizeof(Parser));
+    parser->arena = arena;
+    parser->scanner = create_scanner(expression, diagnostics, arena);
+    parser->diagnostics = diagnostics;
+    parser->mode = mode;
+    parser->ast = NULL; // created after the tokens
+    parser->stack = NULL;
+    parser->stack_capacity = 0;
+    parser->max_depth = PARSER_MAX_DEPTH;
+    parser->hash_cons = 0;
+    parser->cons = NULL;
+    parser->cons_capacity = 0;
+    parser->cons_mask = 0;
+    reset_parser(parser, expression, parser->scanner->length);
+    return parser;
 }
 
-Parser *create_parser(const char *expression)
+void reset_parser(Parser *parser, const char *expression, int length)
 {
-    Parser *parser = (Parser *)malloc(sizeof(Parser));
     parser->expression = expression;
-    parser->scanner = create_scanner(expression);
-    parser->ast = NULL;
     parser->status = 1;
-    tokonize(parser->scanner);
-    parser->curr = parser->scanner->token_list->head;
+    parser->curr = 0;
+    parser->head = 0;
+    parser->count = 0;
+    reset_scanner(parser->scanner, expression, length);
+    // Streaming mode: tokens are scanned as the parser asks for them
+    if (parser->mode == PARSE_BATCH)
+        tokonize(parser->scanner);
+
+    // After the tokens, so both grow in place at the top of the arena
+    if (parser->ast == NULL)
+        parser->ast = create_ast(parser->arena);
+    parser->ast->size = 0;
+    parser->ast->root = AST_NONE;
+    // Batch mode knows the node count, streaming mode grows the table
+    if (parser->hash_cons)
+        reset_cons(parser, parser->mode == PARSE_BATCH ? parser->scanner->token_list->size : 0);
+    if (parser->mode == PARSE_STREAMING)
+        return;
+
+    // A node per token at most, EOL excluded
+    reserve_ast(parser->ast, parser->scanner->token_list->size);
 
 #ifdef DEBUG
     printf("\nScanner status: %d\n\n", parser->scanner->status);
-    print_list(parser->scanner->token_list);
+    print_list(expression, parser->scanner->token_list);
     printf("\n");
 #endif
-
-    return parser;
 }
 
 void free_parser(Parser *parser)
@@ -116,74 +183,212 @@ void free_parser(Parser *parser)
     if (parser) {
         free_scanner(parser->scanner);
         free_ast(parser->ast);
-        free(parser);
+        arena_free(parser->arena, parser->stack);
+        arena_free(parser->arena, parser->cons);
+        arena_free(parser->arena, parser);
+    }
+}
+
+#define CONS_MIN_CAPACITY 16
+
+// Empty table for nodes nodes at a load factor of at most 1/2. Only the
+// slots of this size are cleared, a large expression doesn't slow down
+// the small ones after it.
+void reset_cons(Parser *parser, int nodes)
+{
+    int capacity = CONS_MIN_CAPACITY;
+    while (capacity < nodes * 2)
+        capacity *= 2;
+    if (capacity > parser->cons_capacity) {
+        // Old entries are not needed
+        parser->cons = (int32_t *)arena_realloc(parser->arena, parser->cons, 0,
+            capacity * sizeof(int32_t));
+        parser->cons_capacity = capacity;
+    }
+    parser->cons_mask = capacity - 1;
+    memset(parser->cons, 0xff, capacity * sizeof(int32_t)); // AST_NONE
+}
+
+static unsigned hash_node(const Token *token, int left, int right)
+{
+    uint64_t key = token->type;
+    if (token->type == FLOAT || token->type == INTEGER) {
+        uint64_t bits;
+        memcpy(&bits, &token->number, sizeof(bits));
+        key ^= bits;
+    } else if (token->type == ID) {
+        key ^= (uint64_t)(uint32_t)token->symbol << 8;
+    }
+    key = (key ^ (uint32_t)left) * 0x9E3779B97F4A7C15ull;
+    key = (key ^ (uint32_t)right) * 0x9E3779B97F4A7C15ull;
+    return (unsigned)(key >> 32);
+}
+
+// Equal for evaluation: literals compare bitwise, so 0.0 and -0.0 differ
+static int same_node(const AstNode *node, const Token *token, int left, int right)
+{
+    if (node->token.type != token->type || node->child[0] != left || node->child[1] != right)
+        return 0;
+    switch (token->type) {
+    case FLOAT:
+    case INTEGER:
+        return memcmp(&node->token.number, &token->number, sizeof(double)) == 0;
+    case ID:
+        return node->token.symbol == token->symbol;
+    default:
+        return 1;
     }
 }
 
+static int32_t *find_slot(Parser *parser, const Token *token, int left, int right)
+{
+    unsigned slot = hash_node(token, left, right) & parser->cons_mask;
+    for (;;) {
+        int32_t index = parser->cons[slot];
+        if (index == AST_NONE || same_node(&parser->ast->nodes[index], token, left, right))
+            return &parser->cons[slot];
+        slot = (slot + 1) & parser->cons_mask;
+    }
+}
+
+// Add a node, or with hash_cons return the equal node if there is one
+static int make_node(Parser *parser, const Token *token, int left, int right)
+{
+    Ast *ast = parser->ast;
+    if (!parser->hash_cons)
+        return add_ast_node(ast, token, left, right);
+
+    if ((unsigned)(ast->size + 1) * 2 > parser->cons_mask + 1) {
+        // Streaming: rehash, nodes in the array are all distinct
+        reset_cons(parser, ast->size + 1);
+        for (int i = 0; i < ast->size; i++) {
+            const AstNode *node = &ast->nodes[i];
+            *find_slot(parser, &node->token, node->child[0], node->child[1]) = i;
+        }
+    }
+    int32_t *slot = find_slot(parser, token, left, right);
+    if (*slot == AST_NONE)
+        *slot = add_ast_node(ast, token, left, right);
+    return *slot;
+}
+
+// Streaming mode: scan until the ring buffer holds n tokens
+void fill_lookahead(Parser *parser, int n)
+{
+    while (parser->count < n) {
+        int slot = (parser->head + parser->count) & (PARSER_LOOKAHEAD - 1);
+        parser->lookahead[slot] = next_token(parser->scanner);
+        parser->count++;
+    }
+}
+
+// Current token, the trailing EOL token once input is exhausted
+Token *current_token(Parser *parser)
+{
+    if (parser->mode == PARSE_STREAMING) {
+        fill_lookahead(parser, 1);
+        return &parser->lookahead[parser->head];
+    }
+    return &parser->scanner->token_list->tokens[parser->curr];
+}
+
+// One token lookahead
+Token *peek_token(Parser *parser)
+{
+    if (parser->mode == PARSE_STREAMING) {
+        if (current_token(parser)->type == EOL)
+            return current_token(parser);
+        fill_lookahead(parser, 2);
+        return &parser->lookahead[(parser->head + 1) & (PARSER_LOOKAHEAD - 1)];
+    }
+    TokenList *list = parser->scanner->token_list;
+    int next = parser->curr + 1 < list->size ? parser->curr + 1 : parser->curr;
+    return &list->tokens[next];
+}
+
+// Never moves past the EOL token
 void advance(Parser *parser)
 {
-    if (parser->curr)
-        parser->curr = parser->curr->next;
+    if (parser->mode == PARSE_STREAMING) {
+        if (current_token(parser)->type != EOL) {
+            parser->head = (parser->head + 1) & (PARSER_LOOKAHEAD - 1);
+            parser->count--;
+        }
+        return;
+    }
+    if (parser->curr + 1 < parser->scanner->token_list->size)
+        parser->curr++;
 }
 
 // Eat expected token
 int expect_token(Parser *parser, TokenType expected)
 {
-    if (parser->curr && parser->curr->token->type == expected) {
+    if (current_token(parser)->type == expected) {
         return 1;
     }
     return 0;
 }
 
 // Report syntax error
-void report_error(Parser *parser, const char *msg)
+void report_error(Parser *parser, DiagnosticId id)
 {
     // if (// parser->stop_error_report) return; // already reported
     parser->status = 0;
-    if (parser->curr) {
-        int position = parser->curr->token->position + 1;
-        fprintf(stderr, "Syntax Error: %s at position: %d.\n", msg, position);
-    }
+    const Token *token = current_token(parser);
+    // Streaming mode: after a lexical error only the scanner reports
+    if (!parser->scanner->status)
+        return;
+    report_diagnostic(parser->diagnostics, id, token->position, token->length);
 }
 
-int is_token_in_set(TokenType type, TokenType set[], int size)
+// Identifier resolved by the scanner to a builtin of the given kind
+int is_builtin(const Token *token, SymbolKind kind)
 {
-    for (int i = 0; i < size; i++) {
-        if (type == set[i])
-            return 1;
-    }
-    return 0;
+    return token->symbol != SYMBOL_UNKNOWN && get_symbol(token->symbol)->kind == kind;
 }
 
-// Sync to synchronization set
-void error_recovery(Parser *parser, TokenType sync_set[], int size)
+// Names are resolved while parsing, evaluation never sees an unknown name
+void report_unknown_name(Parser *parser, const Token *token, DiagnosticId id)
 {
     parser->status = 0;
-    // 垃圾处理：panic-mode 恢复，跳过到同步点（该非终结点的 FLLOW 集）
-    while (parser->curr && !is_token_in_set(parser->curr->token->type, sync_set, size)) {
-        advance(parser);
-    }
+    if (!parser->scanner->status)
+        return;
+    report_diagnostic(parser->diagnostics, id, token->position, token->length);
 }
 
-int expect_tokens(Parser *parser, TokenType set[], int size)
+// Sync to synchronization set
+void error_recovery(Parser *parser, TokenSet sync_set)
 {
-    if (parser->curr && !is_token_in_set(parser->curr->token->type, set, size)) {
-        return 0;
+    parser->status = 0;
+    // 垃圾处理：panic-mode 恢复，跳过到同步点（该非终结点的 FLLOW 集）
+    sync_set |= TOKEN_BIT(EOL); // never past the end
+    if (parser->mode == PARSE_BATCH) {
+        // The token list ends with EOL, scan it directly
+        const Token *tokens = parser->scanner->token_list->tokens;
+        int curr = parser->curr;
+        while (!(TOKEN_BIT(tokens[curr].type) & sync_set))
+            curr++;
+        parser->curr = curr;
+        return;
+    }
+    while (!(TOKEN_BIT(current_token(parser)->type) & sync_set)) {
+        advance(parser);
     }
-    return 1;
 }
 
 // Parser entry
 void parse(Parser *parser)
 {
-    if (parser->scanner->status) {
-        parser->ast = parse_expr(parser, 0);
+    if (parser->mode == PARSE_STREAMING || parser->scanner->status) {
+        parser->ast->root = parse_expr(parser, BP_NONE);
         // 最终检查：应该到达输入结束
-        if (parser->curr && parser->curr->token->type != EOL) {
-            report_error(parser, "Unexpected symbol");
+        if (current_token(parser)->type != EOL) {
+            report_error(parser, DIAG_UNEXPECTED_SYMBOL);
         }
+        // Lexical errors surface during parsing in streaming mode
+        if (!parser->scanner->status)
+            parser->status = 0;
     } else {
-        parser->ast = NULL;
         parser->status = 0;
     }
 
@@ -192,277 +397,238 @@ void parse(Parser *parser)
 #endif
 }
 
-// expr ::= term { ( "+" | "-" ) term }
-AstNode *parse_expr(Parser *parser, int level)
+// Pratt parser: every token type has a row in rules[] saying how it starts
+// an operand (prefix) and how tightly it binds as an infix operator.
+//
+// expr   ::= term { ( + | - ) term }
+// term   ::= unary { ( * | / ) unary }
+// unary  ::= ( + | - ) unary | power
+// power  ::= factor [ ^ unary ]
+// factor ::= ( expr ) | id ( expr ) | id | integer | float
+//
+// A grammar level is the binding power its operands are parsed with, e.g.
+// term is parsed with BP_SUM and unary with BP_UNARY.
+
+// How a token starts an operand
+typedef enum {
+    PREFIX_NONE, // can't start one
+    PREFIX_LITERAL, // integer | float
+    PREFIX_NAME, // id ( expr ) | id
+    PREFIX_GROUP, // ( expr )
+    PREFIX_SIGN // ( + | - ) unary
+} Prefix;
+
+typedef struct {
+    Prefix prefix;
+    BindingPower infix; // left binding power, BP_NONE if not an operator
+    BindingPower right; // binding power of the right operand
+    TokenSet followset; // recovery after a missing right operand
+} ParseRule;
+
+static ParseRule rules[] = {
+    [ERROR] = { PREFIX_NONE, BP_NONE, BP_NONE, 0 },
+    [FLOAT] = { PREFIX_LITERAL, BP_NONE, BP_NONE, 0 },
+    [INTEGER] = { PREFIX_LITERAL, BP_NONE, BP_NONE, 0 },
+    [PLUS] = { PREFIX_SIGN, BP_SUM, BP_SUM, FOLLOW_EXPR },
+    [MINUS] = { PREFIX_SIGN, BP_SUM, BP_SUM, FOLLOW_EXPR },
+    [MULT] = { PREFIX_NONE, BP_PRODUCT, BP_PRODUCT, FOLLOW_TERM },
+    [DIV] = { PREFIX_NONE, BP_PRODUCT, BP_PRODUCT, FOLLOW_TERM },
+    [POW] = { PREFIX_NONE, BP_POWER, BP_UNARY, FOLLOW_UNARY }, // right associative
+    [LPAREN] = { PREFIX_GROUP, BP_NONE, BP_NONE, 0 },
+    [RPAREN] = { PREFIX_NONE, BP_NONE, BP_NONE, 0 },
+    [ID] = { PREFIX_NAME, BP_NONE, BP_NONE, 0 },
+    [EOL] = { PREFIX_NONE, BP_NONE, BP_NONE, 0 },
+};
+
+// What an operand being parsed will become part of
+typedef enum {
+    PENDING_RIGHT, // right operand of an infix operator
+    PENDING_SIGN, // operand of a leading + or -
+    PENDING_GROUP, // expression between parentheses
+    PENDING_ARGUMENT // argument of a function call
+} Pending;
+
+// A nesting level waiting for its operand
+typedef struct ParseFrame {
+    Pending pending;
+    BindingPower rbp; // binding power the level is parsed with
+    int left; // left operand of an infix operator
+    const ParseRule *rule; // the infix operator
+    Token token; // operator or function name, the slot may be reused
+} ParseFrame;
+
+// Returns 0 once max_depth levels are open
+static int push_frame(Parser *parser, int depth, Pending pending, BindingPower rbp)
 {
-#ifdef DEBUG
-    debug(__func__, parser, level);
-#endif
-
-    TokenType firstset[] = { PLUS, MINUS, LPAREN, ID, INTEGER, FLOAT };
-    int firstset_size = sizeof(firstset) / sizeof(firstset[0]);
-    TokenType followset[] = { RPAREN, EOL };
-    int followset_size = sizeof(followset) / sizeof(followset[0]);
-
-    // 检查当前 token 是否在 FIRST(expr) 中
-    if (!expect_tokens(parser, firstset, firstset_size)) {
-        // report_error(parser, "Unexpected symbol");
-        // error_recovery(parser, firstset, firstset_size);
-        // advance(parser);
-        return NULL;
+    if (depth >= parser->max_depth) {
+        report_error(parser, DIAG_TOO_DEEP);
+        error_recovery(parser, 0); // give up on the whole expression
+        return 0;
     }
-
-    // process first term
-    AstNode *left = parse_term(parser, level + 1);
-    if (!left)
-        return NULL;
-
-    // process ( + | -)  term
-    while (parser->curr && (parser->curr->token->type == PLUS || parser->curr->token->type == MINUS)) {
-        Token *token = parser->curr->token;
-        advance(parser);
-        AstNode *right = parse_term(parser, level + 1);
-        if (right) {
-            AstNode *operator= create_ast_node(token);
-            add_child(operator, left);
-            add_child(operator, right);
-            left = operator; // new left
-        } else {
-            report_error(parser, "Expected right operand");
-            error_recovery(parser, followset, followset_size);
-        }
+    if (depth == parser->stack_capacity) {
+        int capacity = depth ? depth * 2 : 64;
+        parser->stack = (ParseFrame *)arena_realloc(parser->arena, parser->stack,
+            depth * sizeof(ParseFrame), capacity * sizeof(ParseFrame));
+        parser->stack_capacity = capacity;
     }
-
-    // 检查 expr 的结束：当前 token 应该在 FOLLOW(expr) 中
-    // if (!expect_tokens(parser, followset, followset_size)) {
-    //     report_error(parser, "Unexpected symbol");
-    //     error_recovery(parser, followset, followset_size);
-    //     // return NULL;
-    // }
-
-    return left;
+    ParseFrame *frame = &parser->stack[depth];
+    frame->pending = pending;
+    frame->rbp = rbp;
+    frame->token = *current_token(parser);
+    return 1;
 }
 
-// term ::= unary { ( * | / ) unary }
-AstNode *parse_term(Parser *parser, int level)
+// factor ::= id, the caller has seen that no "(" follows
+static int parse_constant(Parser *parser)
 {
-#ifdef DEBUG
-    debug(__func__, parser, level);
-#endif
-
-    TokenType firstset[] = { PLUS, MINUS, LPAREN, ID, INTEGER, FLOAT };
-    int firstset_size = sizeof(firstset) / sizeof(firstset[0]);
-    TokenType followset[] = { PLUS, MINUS, RPAREN, EOL };
-    int followset_size = sizeof(followset) / sizeof(followset[0]);
-
-    if (!expect_tokens(parser, firstset, firstset_size)) {
-        // report_error(parser, "Unexpected symbol");
-        // error_recovery(parser, firstset, firstset_size);
-        // advance(parser);
-        return NULL;
-    }
-
-    AstNode *left = parse_unary(parser, level + 1);
-    if (!left)
-        return NULL;
-
-    while (parser->curr && (parser->curr->token->type == MULT || parser->curr->token->type == DIV)) {
-        Token *token = parser->curr->token;
-        advance(parser);
-        AstNode *right = parse_unary(parser, level + 1);
-        if (right) {
-            AstNode *operator= create_ast_node(token);
-            add_child(operator, left);
-            add_child(operator, right);
-            left = operator; // new left
-        } else {
-            report_error(parser, "Expected right operand");
-            error_recovery(parser, followset, followset_size);
-        }
+    Token token = *current_token(parser);
+    if (!is_builtin(&token, SYMBOL_CONSTANT) && !is_builtin(&token, SYMBOL_VARIABLE)) {
+        report_unknown_name(parser, &token, DIAG_UNKNOWN_CONSTANT);
     }
-
-    // if (!expect_tokens(parser, followset, followset_size)) {
-    //     report_error(parser, "Unexpected symbol");
-    //     error_recovery(parser, followset, followset_size);
-    //     // return NULL;
-    // }
-
-    return left;
+    advance(parser);
+    return make_node(parser, &token, AST_NONE, AST_NONE);
 }
 
-// unary ::= ( + | - ) unary | power
-AstNode *parse_unary(Parser *parser, int level)
+// factor ::= ( expr ), node is the expression
+static int finish_group(Parser *parser, int node)
 {
-#ifdef DEBUG
-    debug(__func__, parser, level);
-#endif
-
-    TokenType firstset[] = { PLUS, MINUS, LPAREN, ID, INTEGER, FLOAT };
-    int firstset_size = sizeof(firstset) / sizeof(firstset[0]);
-    TokenType followset[] = { PLUS, MINUS, MULT, DIV, POW, RPAREN, EOL };
-    int followset_size = sizeof(followset) / sizeof(followset[0]);
-
-    if (!expect_tokens(parser, firstset, firstset_size)) {
-        // report_error(parser, "Unexpected symbol");
-        // error_recovery(parser, firstset, firstset_size);
-        // advance(parser);
-        return NULL;
-    }
-
-    AstNode *left = NULL;
-
-    if (parser->curr && (parser->curr->token->type == PLUS || parser->curr->token->type == MINUS)) {
-        Token *token = parser->curr->token;
-        advance(parser);
-        AstNode *right = parse_unary(parser, level + 1);
-        if (right) {
-            AstNode *operator= create_ast_node(token);
-            add_child(operator, right);
-            left = operator;
+    if (node != AST_NONE) {
+        if (expect_token(parser, RPAREN)) {
+            advance(parser);
         } else {
-            report_error(parser, "Expected unary operand");
-            error_recovery(parser, followset, followset_size);
+            report_error(parser, DIAG_EXPECTED_RPAREN);
+            error_recovery(parser, FOLLOW_UNARY);
+            // 返回已解析的部分
         }
-    } else {
-        left = parse_power(parser, level + 1);
     }
-
-    // if (!expect_tokens(parser, followset, followset_size)) {
-    //     report_error(parser, "Unexpected symbol");
-    //     error_recovery(parser, followset, followset_size);
-    //     // return NULL;
-    // }
-
-    return left;
+    return node;
 }
 
-// power ::= factor { ^ unary }
-AstNode *parse_power(Parser *parser, int level)
+// factor ::= id ( expr ), arg is the expression
+static int finish_call(Parser *parser, const Token *token, int arg)
 {
-#ifdef DEBUG
-    debug(__func__, parser, level);
-#endif
-
-    TokenType firstset[] = { LPAREN, ID, INTEGER, FLOAT };
-    int firstset_size = sizeof(firstset) / sizeof(firstset[0]);
-    TokenType followset[] = { PLUS, MINUS, MULT, DIV, POW, RPAREN, EOL };
-    int followset_size = sizeof(followset) / sizeof(followset[0]);
-
-    if (!expect_tokens(parser, firstset, firstset_size)) {
-        // report_error(parser, "Unexpected symbol");
-        // error_recovery(parser, firstset, firstset_size);
-        // advance(parser);
-        return NULL;
-    }
-
-    AstNode *left = parse_factor(parser, level + 1);
-
-    if (parser->curr && (parser->curr->token->type == POW)) {
-        Token *token = parser->curr->token;
-        advance(parser);
-        AstNode *right = parse_unary(parser, level + 1);
-        if (right) {
-            AstNode *operator= create_ast_node(token);
-            add_child(operator, left);
-            add_child(operator, right);
-            left = operator;
+    if (arg != AST_NONE) {
+        if (expect_token(parser, RPAREN)) {
+            advance(parser);
         } else {
-            report_error(parser, "Expected right operand");
-            error_recovery(parser, followset, followset_size);
+            report_error(parser, DIAG_EXPECTED_RPAREN);
+            error_recovery(parser, FOLLOW_UNARY);
+            arg = AST_NONE; // the call node is returned without it
         }
+    } else {
+        // Without an argument the node would look like a constant
+        report_error(parser, DIAG_EXPECTED_ARGUMENT);
+        error_recovery(parser, FOLLOW_UNARY);
+        if (expect_token(parser, RPAREN))
+            advance(parser); // the ) of sin(), not reported again
     }
-
-    // if (!expect_tokens(parser, followset, followset_size)) {
-    //     report_error(parser, "Unexpected symbol");
-    //     error_recovery(parser, followset, followset_size);
-    //     // return NULL;
-    // }
-
-    return left;
+    return make_node(parser, token, arg, AST_NONE);
 }
 
-// factor ::= ( expr ) | id ( expr ) | id | integer | float
-AstNode *parse_factor(Parser *parser, int level)
+// Parse operators binding tighter than rbp. Nesting is kept on an explicit
+// stack of ParseFrame instead of the C stack, each frame is a level of the
+// recursive formulation waiting for an operand.
+int parse_expr(Parser *parser, BindingPower rbp)
 {
+    int depth = 0;
+    for (;;) {
 #ifdef DEBUG
-    debug(__func__, parser, level);
+        debug(__func__, parser, depth);
 #endif
 
-    TokenType firstset[] = { LPAREN, ID, INTEGER, FLOAT };
-    int firstset_size = sizeof(firstset) / sizeof(firstset[0]);
-    TokenType followset[] = { PLUS, MINUS, MULT, DIV, POW, RPAREN, EOL };
-    int followset_size = sizeof(followset) / sizeof(followset[0]);
-
-    if (!expect_tokens(parser, firstset, firstset_size)) {
-        // report_error(parser, "Unexpected symbol");
-        // error_recovery(parser, firstset, firstset_size);
-        // advance(parser);
-        return NULL;
-    }
-
-    if (!parser->curr) {
-        report_error(parser, "Terminated abnormally");
-        return NULL;
-    }
-
-    Token *token = parser->curr->token;
-    AstNode *node = NULL;
-    if (token->type == FLOAT) {
-        node = create_ast_node(token);
-        advance(parser);
-        // return node;
-    } else if (token->type == INTEGER) {
-        node = create_ast_node(token);
-        advance(parser);
-        // return node;
-    } else if (token->type == LPAREN) {
-        advance(parser);
-        node = parse_expr(parser, level + 1);
-        if (node) {
-            if (expect_token(parser, RPAREN)) {
-                advance(parser);
-                // return node;
-            } else {
-                report_error(parser, "Expected ')'");
-                error_recovery(parser, followset, followset_size);
-                // return node;  // 返回已解析的部分
+        // Start an operand
+        // 检查当前 token 是否在 FIRST(expr) 中
+        const ParseRule *rule = &rules[current_token(parser)->type];
+        int left = AST_NONE;
+        int power = 1; // ^ only follows a factor, a second one is left to the caller
+        switch (rule->prefix) {
+        case PREFIX_NONE:
+            break;
+        case PREFIX_LITERAL:
+            left = make_node(parser, current_token(parser), AST_NONE, AST_NONE);
+            advance(parser);
+            break;
+        case PREFIX_NAME:
+            if (peek_token(parser)->type != LPAREN) {
+                left = parse_constant(parser);
+                break;
             }
-        }
-    } else if (token->type == ID) {
-        TokenListNode *next_token = parser->curr->next;
-
-        if (next_token && next_token->token->type == LPAREN) { // function call
-            node = create_ast_node(token);
+            // function call
+            if (!is_builtin(current_token(parser), SYMBOL_FUNCTION)) {
+                report_unknown_name(parser, current_token(parser), DIAG_UNKNOWN_FUNCTION);
+            }
+            if (!push_frame(parser, depth, PENDING_ARGUMENT, rbp))
+                return AST_NONE;
+            depth++;
             advance(parser); // function name
             advance(parser); // LPAREN
-            AstNode *arg = parse_expr(parser, level + 1);
-            if (arg) {
-                if (expect_token(parser, RPAREN)) {
-                    add_child(node, arg);
+            rbp = BP_NONE;
+            continue;
+        case PREFIX_GROUP:
+            if (!push_frame(parser, depth, PENDING_GROUP, rbp))
+                return AST_NONE;
+            depth++;
+            advance(parser);
+            rbp = BP_NONE;
+            continue;
+        case PREFIX_SIGN:
+            if (!push_frame(parser, depth, PENDING_SIGN, rbp))
+                return AST_NONE;
+            depth++;
+            advance(parser);
+            rbp = BP_UNARY;
+            continue;
+        }
+
+        // Combine complete operands until an operator wants another one
+        for (;;) {
+            if (left != AST_NONE) {
+                const ParseRule *infix = &rules[current_token(parser)->type];
+                if (infix->infix > rbp && (infix->infix != BP_POWER || power)) {
+                    if (!push_frame(parser, depth, PENDING_RIGHT, rbp))
+                        return AST_NONE;
+                    parser->stack[depth].left = left;
+                    parser->stack[depth].rule = infix;
+                    depth++;
                     advance(parser);
-                    // return node;
+                    rbp = infix->right;
+                    break;
+                }
+            }
+
+            // This level is done, left is its result
+            if (depth == 0)
+                return left;
+            ParseFrame *frame = &parser->stack[--depth];
+            rbp = frame->rbp;
+            power = 0;
+            switch (frame->pending) {
+            case PENDING_RIGHT:
+                if (left != AST_NONE) {
+                    left = make_node(parser, &frame->token, frame->left, left); // new left
                 } else {
-                    report_error(parser, "Expected ')'");
-                    error_recovery(parser, followset, followset_size);
-                    // return node;  // 返回已解析的部分
+                    report_error(parser, DIAG_EXPECTED_RIGHT_OPERAND);
+                    error_recovery(parser, frame->rule->followset);
+                    left = frame->left;
                 }
+                break;
+            case PENDING_SIGN:
+                if (left != AST_NONE) {
+                    left = make_node(parser, &frame->token, left, AST_NONE);
+                } else {
+                    report_error(parser, DIAG_EXPECTED_UNARY_OPERAND);
+                    error_recovery(parser, FOLLOW_UNARY);
+                }
+                break;
+            case PENDING_GROUP:
+                left = finish_group(parser, left);
+                power = 1;
+                break;
+            case PENDING_ARGUMENT:
+                left = finish_call(parser, &frame->token, left);
+                power = 1;
+                break;
             }
-        } else { // constant
-            node = create_ast_node(token);
-            advance(parser);
-            // return node;
         }
-    } else {
-        report_error(parser, "Unexpected symbol");
-        error_recovery(parser, followset, followset_size);
-        // return NULL;
     }
-
-    // if (!expect_tokens(parser, followset, followset_size)) {
-    //     report_error(parser, "Unexpected symbol");
-    //     error_recovery(parser, followset, followset_size);
-    //     // return NULL;
-    // }
-
-    return node;
-}
\ No newline at end of file
+}
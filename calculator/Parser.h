@@ -1,43 +1,90 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "Diagnostics.h"
 #include "Scanner.h"
+#include <stdint.h>
 
-// Abstract Syntax Trees (ASTs) are typically multi-way tree structures,
-// where each node (such as a function definition) may have multiple child
-// nodes (such as argument lists and function bodies). To represent and
-// process ASTs in a binary tree, we can use the Left-Child Right-Sibling
-// representation, a classic method for converting multi-way trees to
-// binary trees.
+// The Abstract Syntax Tree is stored flat: nodes live in one array in
+// post-order, so every child comes before its parent and the root is the
+// last node. Children are referred to by 32-bit indices instead of
+// pointers, a tree is evaluated by sweeping the array from left to right.
+//
+// With Parser.hash_cons a node equal to an existing one (same operator,
+// literal or symbol and same children) is not added again, the parent
+// refers to the existing node instead. The result is a DAG in the same
+// order, the sweep then computes each shared subexpression once.
+
+#define AST_NONE -1 // no child
 
 // Abstract Syntax Tree Node
 typedef struct AstNode {
-    Token *token; // token pointer
-    struct AstNode *firstChild; // left: child
-    struct AstNode *nextSibling; // right: sibling
+    Token token; // token copy, independent of the token source
+    int32_t child[2]; // left and right operand, only left for signs and calls
 } AstNode;
 
-// Create a AST node
-AstNode *create_ast_node(Token *token);
+typedef struct Ast {
+    AstNode *nodes;
+    int size;
+    int capacity;
+    Arena *arena; // where nodes are allocated, NULL for the heap
+    int root; // index of the root, AST_NONE for an empty tree
+} Ast;
+
+Ast *create_ast(Arena *arena);
+
+// Make room for size nodes
+void reserve_ast(Ast *ast, int size);
 
-// Append a child to parent's child list
-void add_child(AstNode *parent, AstNode *child);
+// Append a node after its children, returns its index
+int add_ast_node(Ast *ast, const Token *token, int left, int right);
 
-// Postorder print
-void print_ast(AstNode *root);
+// Postorder print, a shared node is printed once
+void print_ast(const char *expression, const Ast *ast);
 
 // Destroy AST
-void free_ast(AstNode *ast);
+void free_ast(Ast *ast);
+
+// Where the parser takes its tokens from
+typedef enum {
+    PARSE_BATCH, // tokonize() the whole expression first
+    PARSE_STREAMING // pull tokens from the scanner on demand
+} ParseMode;
+
+// Lookahead ring buffer size in streaming mode, a power of two
+#define PARSER_LOOKAHEAD 4
+
+// Default nesting limit of parentheses, signs, calls and ^ chains
+#define PARSER_MAX_DEPTH 1000000
 
 typedef struct Parser {
     const char *expression;
     Scanner *scanner;
-    TokenListNode *curr;
-    AstNode *ast;
+    Arena *arena; // owns parser, scanner, tokens and AST, NULL for the heap
+    ParseMode mode;
+    int curr; // index of current token in the token list (batch)
+    Token lookahead[PARSER_LOOKAHEAD]; // scanned, unconsumed tokens (streaming)
+    int head; // ring buffer slot of the current token
+    int count; // tokens in the ring buffer
+    Ast *ast;
+    struct ParseFrame *stack; // open nesting levels, see parse_expr()
+    int stack_capacity;
+    int max_depth; // deeper input fails with DIAG_TOO_DEEP
+    int hash_cons; // share equal subtrees, the AST becomes a DAG
+    int32_t *cons; // hash table of node indices, see make_node()
+    int cons_capacity;
+    unsigned cons_mask; // slots in use - 1, sized for the expression
+    Diagnostics *diagnostics; // syntax errors go here, may be NULL
     int status; // 1 for success, 0 for failure
 } Parser;
 
-Parser *create_parser(const char *expression);
+// Everything is allocated from arena, free_parser() is then optional and
+// reset_arena() releases it all, the parser included
+Parser *create_parser(const char *expression, ParseMode mode,
+    Diagnostics *diagnostics, Arena *arena);
+// Start over with another expression of length characters, which needs no
+// NUL terminator. Scanner, token and AST storage are reused.
+void reset_parser(Parser *parser, const char *expression, int length);
 void parse(Parser *parser);
 void free_parser(Parser *parser);
 
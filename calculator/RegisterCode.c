@@ -0,0 +1,375 @@
+#include "RegisterCode.h"
+#include "Symbol.h"
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// While compiling, constant k is register -(k + 1) until the number of
+// temporaries is known and the constants can be placed after them
+#define ANS_REGISTER 0
+#define CONSTANT_REGISTER(k) (-(k) - 1)
+#define NO_REGISTER INT32_MIN
+
+typedef struct Compiler {
+    const Ast *ast;
+    RegisterCode *code;
+    int code_capacity;
+    int constant_capacity;
+    int function_capacity;
+    int32_t *refs; // parents of a node, 0 if unreachable
+    int32_t *remaining; // parents not compiled yet
+    int32_t *reg; // register holding the value of a node
+    char *fused; // computed by the parent's instruction
+    int32_t *free_temporaries;
+    int free_count;
+} Compiler;
+
+typedef struct Visit {
+    int32_t node;
+    int32_t next; // child to visit next
+} Visit;
+
+static void *grow(void *items, int *capacity, size_t item)
+{
+    *capacity = *capacity ? *capacity * 2 : 16;
+    items = realloc(items, *capacity * item);
+    assert(items != NULL);
+    return items;
+}
+
+static const AstNode *node_at(const Compiler *compiler, int node)
+{
+    return &compiler->ast->nodes[node];
+}
+
+static int is_binary(const AstNode *node, TokenType type)
+{
+    return node->token.type == type && node->child[1] != AST_NONE;
+}
+
+// Unary plus is the identity, it is skipped to its operand
+static int resolve(const Compiler *compiler, int node)
+{
+    while (node != AST_NONE && node_at(compiler, node)->token.type == PLUS
+        && node_at(compiler, node)->child[1] == AST_NONE)
+        node = node_at(compiler, node)->child[0];
+    return node;
+}
+
+static int operand(const Compiler *compiler, int node, int k)
+{
+    return resolve(compiler, node_at(compiler, node)->child[k]);
+}
+
+static int add_constant(Compiler *compiler, double value)
+{
+    RegisterCode *code = compiler->code;
+    if (code->constant_count == compiler->constant_capacity)
+        code->constants = (double *)grow(code->constants, &compiler->constant_capacity, sizeof(double));
+    code->constants[code->constant_count] = value;
+    return CONSTANT_REGISTER(code->constant_count++);
+}
+
+static int add_function(Compiler *compiler, double (*function)(double))
+{
+    RegisterCode *code = compiler->code;
+    if (code->function_count == compiler->function_capacity)
+        code->functions = (double (**)(double))grow(code->functions,
+            &compiler->function_capacity, sizeof(*code->functions));
+    code->functions[code->function_count] = function;
+    return code->function_count++;
+}
+
+// Register of a compiled node, a temporary is free again after its last use
+static int use(Compiler *compiler, int node)
+{
+    int reg = compiler->reg[node];
+    if (--compiler->remaining[node] == 0 && reg > ANS_REGISTER)
+        compiler->free_temporaries[compiler->free_count++] = reg;
+    return reg;
+}
+
+static int new_temporary(Compiler *compiler)
+{
+    if (compiler->free_count > 0)
+        return compiler->free_temporaries[--compiler->free_count];
+    return 1 + compiler->code->temporaries++;
+}
+
+// Operands are used before the destination is taken, so it can reuse one
+static void emit(Compiler *compiler, int node, RegisterOpcode op, int a, int b, int c)
+{
+    RegisterCode *code = compiler->code;
+    if (code->size == compiler->code_capacity)
+        code->code = (RegisterInstruction *)grow(code->code, &compiler->code_capacity,
+            sizeof(RegisterInstruction));
+    RegisterInstruction *instruction = &code->code[code->size++];
+    instruction->op = op;
+    instruction->dst = compiler->reg[node] = new_temporary(compiler);
+    instruction->a = a;
+    instruction->b = b;
+    instruction->c = c;
+}
+
+// Children are compiled, operands of a fused child are used directly
+static void compile_node(Compiler *compiler, int node)
+{
+    const AstNode *ast_node = node_at(compiler, node);
+    const Token *token = &ast_node->token;
+    if (compiler->fused[node])
+        return;
+
+    if (ast_node->child[0] == AST_NONE) { // leaf
+        if (token->type == FLOAT || token->type == INTEGER) {
+            compiler->reg[node] = add_constant(compiler, token->number);
+        } else {
+            const Symbol *symbol = get_symbol(token->symbol);
+            compiler->reg[node] = symbol->kind == SYMBOL_VARIABLE // ans
+                ? ANS_REGISTER
+                : add_constant(compiler, symbol->value);
+        }
+        return;
+    }
+
+    int left = operand(compiler, node, 0);
+    int right = ast_node->child[1] != AST_NONE ? operand(compiler, node, 1) : AST_NONE;
+    switch (token->type) {
+    case ID: {
+        int function = add_function(compiler, get_symbol(token->symbol)->function);
+        if (compiler->fused[left]) {
+            RegisterOpcode op = REG_CALL_ADD + (node_at(compiler, left)->token.type - PLUS);
+            int a = use(compiler, operand(compiler, left, 0));
+            int b = use(compiler, operand(compiler, left, 1));
+            emit(compiler, node, op, a, b, function);
+        } else {
+            emit(compiler, node, REG_CALL, use(compiler, left), 0, function);
+        }
+        break;
+    }
+    case PLUS:
+    case MINUS:
+        if (right == AST_NONE) {
+            emit(compiler, node, REG_NEG, use(compiler, left), 0, 0); // unary plus is resolved
+        } else if (compiler->fused[left]) {
+            int a = use(compiler, operand(compiler, left, 0));
+            int b = use(compiler, operand(compiler, left, 1));
+            int c = use(compiler, right);
+            emit(compiler, node, token->type == PLUS ? REG_MUL_ADD : REG_MUL_SUB, a, b, c);
+        } else if (compiler->fused[right]) {
+            int a = use(compiler, operand(compiler, right, 0));
+            int b = use(compiler, operand(compiler, right, 1));
+            int c = use(compiler, left);
+            emit(compiler, node, token->type == PLUS ? REG_ADD_MUL : REG_SUB_MUL, a, b, c);
+        } else {
+            int a = use(compiler, left);
+            int b = use(compiler, right);
+            emit(compiler, node, token->type == PLUS ? REG_ADD : REG_SUB, a, b, 0);
+        }
+        break;
+    case MULT:
+    case DIV: {
+        int a = use(compiler, left);
+        int b = use(compiler, right);
+        // x*x of one node, as fast math writes x^2
+        int square = token->type == MULT && left == right;
+        emit(compiler, node, square ? REG_SQUARE : token->type == MULT ? REG_MUL : REG_DIV, a, b, 0);
+        break;
+    }
+    case POW: {
+        // Not x*x for x^2: pow() may round the square differently
+        int a = use(compiler, left);
+        int b = use(compiler, right);
+        emit(compiler, node, REG_POW, a, b, 0);
+        break;
+    }
+    default:
+        assert(0 && "not an AST node");
+    }
+}
+
+// Parents come after their children, so a pass from the root down sees
+// every parent of a node before the node itself
+static void find_fusions(Compiler *compiler, int root)
+{
+    for (int node = root; node >= 0; node--) {
+        if (compiler->refs[node] == 0 || compiler->fused[node])
+            continue;
+        const AstNode *ast_node = node_at(compiler, node);
+        if (is_binary(ast_node, PLUS) || is_binary(ast_node, MINUS)) {
+            // a*b+c, or c+a*b
+            for (int k = 0; k < 2; k++) {
+                int child = operand(compiler, node, k);
+                if (is_binary(node_at(compiler, child), MULT) && compiler->refs[child] == 1) {
+                    compiler->fused[child] = 1;
+                    break;
+                }
+            }
+        } else if (ast_node->token.type == ID && ast_node->child[0] != AST_NONE) {
+            // f(a op b)
+            int arg = operand(compiler, node, 0);
+            const AstNode *arg_node = node_at(compiler, arg);
+            if (arg_node->child[1] != AST_NONE && arg_node->token.type >= PLUS
+                && arg_node->token.type <= DIV && compiler->refs[arg] == 1)
+                compiler->fused[arg] = 1;
+        }
+    }
+}
+
+// Constants go after the temporaries
+static int relocate(const RegisterCode *code, int reg)
+{
+    return reg < 0 ? 1 + code->temporaries + (-reg - 1) : reg;
+}
+
+RegisterCode *compile_register_code(const Ast *ast)
+{
+    assert(ast->root != AST_NONE);
+    RegisterCode *code = (RegisterCode *)calloc(1, sizeof(RegisterCode));
+    assert(code != NULL);
+
+    int size = ast->root + 1;
+    Compiler compiler;
+    memset(&compiler, 0, sizeof(compiler));
+    compiler.ast = ast;
+    compiler.code = code;
+    compiler.refs = (int32_t *)calloc(size, sizeof(int32_t));
+    compiler.remaining = (int32_t *)malloc(size * sizeof(int32_t));
+    compiler.reg = (int32_t *)malloc(size * sizeof(int32_t));
+    compiler.fused = (char *)calloc(size, 1);
+    compiler.free_temporaries = (int32_t *)malloc(size * sizeof(int32_t));
+    Visit *stack = (Visit *)malloc(size * sizeof(Visit));
+    assert(compiler.refs && compiler.remaining && compiler.reg && compiler.fused
+        && compiler.free_temporaries && stack);
+
+    int root = resolve(&compiler, ast->root);
+    compiler.refs[root] = 1;
+    for (int node = root; node >= 0; node--) {
+        compiler.reg[node] = NO_REGISTER;
+        if (compiler.refs[node] == 0)
+            continue;
+        for (int k = 0; k < 2; k++) {
+            if (ast->nodes[node].child[k] != AST_NONE)
+                compiler.refs[operand(&compiler, node, k)]++;
+        }
+    }
+    memcpy(compiler.remaining, compiler.refs, size * sizeof(int32_t));
+    find_fusions(&compiler, root);
+
+    // Postorder, a node shared in a DAG is compiled once
+    int top = 0;
+    stack[top].node = root;
+    stack[top++].next = 0;
+    while (top > 0) {
+        Visit *visit = &stack[top - 1];
+        int node = visit->node;
+        if (visit->next < 2) {
+            int k = visit->next++;
+            if (node_at(&compiler, node)->child[k] != AST_NONE) {
+                int child = operand(&compiler, node, k);
+                if (compiler.reg[child] == NO_REGISTER) {
+                    stack[top].node = child;
+                    stack[top++].next = 0;
+                }
+            }
+            continue;
+        }
+        compile_node(&compiler, node);
+        top--;
+    }
+
+    code->result = relocate(code, compiler.reg[root]);
+    for (int i = 0; i < code->size; i++) {
+        RegisterInstruction *instruction = &code->code[i];
+        instruction->a = relocate(code, instruction->a);
+        instruction->b = relocate(code, instruction->b);
+        if (instruction->op >= REG_MUL_ADD && instruction->op <= REG_SUB_MUL)
+            instruction->c = relocate(code, instruction->c);
+    }
+
+    free(compiler.refs);
+    free(compiler.remaining);
+    free(compiler.reg);
+    free(compiler.fused);
+    free(compiler.free_temporaries);
+    free(stack);
+    return code;
+}
+
+void free_register_code(RegisterCode *code)
+{
+    if (code) {
+        free(code->code);
+        free(code->constants);
+        free(code->functions);
+    }
+    free(code);
+}
+
+int register_code_memory(const RegisterCode *code)
+{
+    return 1 + code->temporaries + code->constant_count;
+}
+
+double run_register_code(const RegisterCode *code, double ans, double *r)
+{
+    r[ANS_REGISTER] = ans;
+    if (code->constant_count > 0)
+        memcpy(r + 1 + code->temporaries, code->constants, code->constant_count * sizeof(double));
+
+    double (**functions)(double) = code->functions;
+    const RegisterInstruction *end = code->code + code->size;
+    for (const RegisterInstruction *ip = code->code; ip < end; ip++) {
+        switch (ip->op) {
+        case REG_NEG:
+            r[ip->dst] = -r[ip->a];
+            break;
+        case REG_ADD:
+            r[ip->dst] = r[ip->a] + r[ip->b];
+            break;
+        case REG_SUB:
+            r[ip->dst] = r[ip->a] - r[ip->b];
+            break;
+        case REG_MUL:
+            r[ip->dst] = r[ip->a] * r[ip->b];
+            break;
+        case REG_DIV:
+            r[ip->dst] = r[ip->a] / r[ip->b];
+            break;
+        case REG_POW:
+            r[ip->dst] = pow(r[ip->a], r[ip->b]);
+            break;
+        case REG_SQUARE:
+            r[ip->dst] = r[ip->a] * r[ip->a];
+            break;
+        case REG_CALL:
+            r[ip->dst] = functions[ip->c](r[ip->a]);
+            break;
+        case REG_MUL_ADD:
+            r[ip->dst] = r[ip->a] * r[ip->b] + r[ip->c];
+            break;
+        case REG_ADD_MUL:
+            r[ip->dst] = r[ip->c] + r[ip->a] * r[ip->b];
+            break;
+        case REG_MUL_SUB:
+            r[ip->dst] = r[ip->a] * r[ip->b] - r[ip->c];
+            break;
+        case REG_SUB_MUL:
+            r[ip->dst] = r[ip->c] - r[ip->a] * r[ip->b];
+            break;
+        case REG_CALL_ADD:
+            r[ip->dst] = functions[ip->c](r[ip->a] + r[ip->b]);
+            break;
+        case REG_CALL_SUB:
+            r[ip->dst] = functions[ip->c](r[ip->a] - r[ip->b]);
+            break;
+        case REG_CALL_MUL:
+            r[ip->dst] = functions[ip->c](r[ip->a] * r[ip->b]);
+            break;
+        case REG_CALL_DIV:
+            r[ip->dst] = functions[ip->c](r[ip->a] / r[ip->b]);
+            break;
+        }
+    }
+    return r[code->result];
+}
@@ -0,0 +1,63 @@
+#ifndef REGISTER_CODE_H
+#define REGISTER_CODE_H
+
+#include "Parser.h"
+#include <stdint.h>
+
+// A parsed expression compiled to three-address code, r[dst] = r[a] op r[b].
+// Literals, constants and ans live in registers of their own, so leaves
+// cost no instruction, and frequent shapes are fused into one instruction:
+// a*b+c, c+a*b, a*b-c, c-a*b, x*x and f(a op b). Unary plus is dropped.
+//
+// Registers: r[0] is ans, then the temporaries, then the constants.
+
+typedef enum {
+    REG_NEG, // dst = -a
+    REG_ADD, // dst = a + b
+    REG_SUB,
+    REG_MUL,
+    REG_DIV,
+    REG_POW,
+    REG_SQUARE, // dst = a * a, for x*x of one node
+    REG_CALL, // dst = functions[c](a)
+    REG_MUL_ADD, // dst = a * b + c
+    REG_ADD_MUL, // dst = c + a * b
+    REG_MUL_SUB, // dst = a * b - c
+    REG_SUB_MUL, // dst = c - a * b
+    REG_CALL_ADD, // dst = functions[c](a + b)
+    REG_CALL_SUB,
+    REG_CALL_MUL,
+    REG_CALL_DIV
+} RegisterOpcode;
+
+typedef struct RegisterInstruction {
+    int32_t op;
+    int32_t dst;
+    int32_t a;
+    int32_t b;
+    int32_t c;
+} RegisterInstruction;
+
+typedef struct RegisterCode {
+    RegisterInstruction *code;
+    int size;
+    double *constants; // loaded into the registers after the temporaries
+    int constant_count;
+    double (**functions)(double);
+    int function_count;
+    int temporaries;
+    int result; // register of the value
+} RegisterCode;
+
+// Compile a well formed tree or DAG, e.g. of a successful parse or
+// get_ast(). The result doesn't refer to the AST.
+RegisterCode *compile_register_code(const Ast *ast);
+void free_register_code(RegisterCode *code);
+
+// Registers run_register_code() needs
+int register_code_memory(const RegisterCode *code);
+
+// Run with memory of register_code_memory() doubles
+double run_register_code(const RegisterCode *code, double ans, double *memory);
+
+#endif // REGISTER_CODE_H
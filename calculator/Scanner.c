@@ -2,11 +2,11 @@
 // 在文法中去掉正负号的处理 (sign)
 // 把正负号当做一元运算处理
 
-#define _GNU_SOURCE // Resolve 'strndup' in GCC
 #include "Scanner.h"
+#include "Symbol.h"
+#include "number.h"
 #include "strext.h"
 #include <assert.h>
-#include <ctype.h>
 #include <errno.h>
 #include <float.h>
 #include <limits.h>
@@ -15,213 +15,246 @@
 #include <stdlib.h>
 #include <string.h>
 
-Token *create_token(TokenType type, const char *src,
-    int position, int size)
-{
-    Token *token = (Token *)malloc(sizeof(Token));
-    token->literal = strndup(src + position, size);
-    token->type = type;
-    token->position = position;
-    return token;
-}
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SCANNER_SSE2 1
+#endif
 
-Token *create_eol_token(int position)
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+Token create_token(TokenType type, int position, int size)
 {
-    Token *token = (Token *)malloc(sizeof(Token));
-    token->literal = NULL;
-    token->type = EOL;
-    token->position = position;
+    Token token;
+    token.type = type;
+    token.position = position;
+    token.length = size;
+    token.symbol = SYMBOL_UNKNOWN;
+    token.number = 0.0;
+    token.integer = 0;
     return token;
 }
 
-void free_token(Token *token)
+Token create_eol_token(int position)
 {
-    if (token)
-        free(token->literal);
-    free(token);
+    return create_token(EOL, position, 0);
 }
 
+#define TOKEN_LIST_INIT_CAPACITY 16
+
 // Create a list
-TokenList *create_list()
+TokenList *create_list(Arena *arena)
 {
-    TokenList *list = (TokenList *)malloc(sizeof(TokenList));
-    assert(list != NULL);
-    list->head = NULL; // Sentinel data is unused
-    list->tail = NULL;
+    TokenList *list = (TokenList *)arena_alloc(arena, sizeof(TokenList));
+    list->tokens = (Token *)arena_alloc(arena, TOKEN_LIST_INIT_CAPACITY * sizeof(Token));
+    list->arena = arena;
     list->size = 0;
+    list->capacity = TOKEN_LIST_INIT_CAPACITY;
     return list;
 }
 
-// Create a list node
-TokenListNode *create_list_node(Token *token)
-{
-    TokenListNode *node = (TokenListNode *)malloc(sizeof(TokenListNode));
-    if (node != NULL) {
-        node->token = token;
-        node->next = NULL;
-        node->prev = NULL;
-    }
-    return node;
-}
-
-void free_list_node(TokenListNode *node)
-{
-    if (node)
-        free_token(node->token);
-    free(node);
-}
-
 // Destroy a list
 void free_list(TokenList *list)
 {
     if (list == NULL)
         return;
-    TokenListNode *curr = list->head;
-    while (curr != NULL) {
-        TokenListNode *next = curr->next;
-        free_token(curr->token);
-        free(curr);
-        curr = next;
-    }
-    free(list);
+    arena_free(list->arena, list->tokens);
+    arena_free(list->arena, list);
 }
 
-void print_list(TokenList *list)
+void print_list(const char *expression, TokenList *list)
 {
     if (list == NULL)
         return;
-    TokenListNode *curr = list->head;
     printf("%d token(s):\n", list->size);
-    while (curr != NULL) {
-        printf("type: %8s, literal: %s\n",
-            TokenName[curr->token->type], curr->token->literal);
-        curr = curr->next;
+    for (int i = 0; i < list->size; i++) {
+        Token *token = &list->tokens[i];
+        printf("type: %8s, literal: %.*s\n", TokenName[token->type],
+            token->length, expression + token->position);
     }
 }
 
-// Append a node to the list
-void append_token(TokenList *list, TokenListNode *node)
+// Make room for size tokens, growing the buffer geometrically
+static void reserve_tokens(TokenList *list, int size)
 {
-    if (list->tail == NULL) { // empty list
-        list->head = node;
-        list->tail = node;
-    } else {
-        list->tail->next = node;
-        node->prev = list->tail;
-        list->tail = node;
+    if (size <= list->capacity)
+        return;
+    int capacity = list->capacity * 2;
+    while (capacity < size)
+        capacity *= 2;
+    list->tokens = (Token *)arena_realloc(list->arena, list->tokens,
+        list->capacity * sizeof(Token), capacity * sizeof(Token));
+    list->capacity = capacity;
+}
+
+// Append a token to the list
+void append_token(TokenList *list, Token token)
+{
+    reserve_tokens(list, list->size + 1);
+    list->tokens[list->size++] = token;
+}
+
+// Character classes, ASCII only so the result does not depend on the locale
+#define CHAR_SPACE 1
+#define CHAR_ALPHA 2
+#define CHAR_DIGIT 4
+
+static const unsigned char char_class[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 0, 0, 0, 0, 0, 0,
+    0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0,
+    0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0, 0, 0,
+    // 0x80 - 0xFF: no class
+};
+
+static int is_class(char ch, unsigned char cls)
+{
+    return char_class[(unsigned char)ch] & cls;
+}
+
+#ifdef SCANNER_SSE2
+
+static int first_set_bit(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Bytes in [lo, lo + span], as an unsigned range check
+static __m128i in_range(__m128i chars, char lo, char span)
+{
+    __m128i offset = _mm_sub_epi8(chars, _mm_set1_epi8(lo));
+    __m128i limit = _mm_set1_epi8(span);
+    return _mm_cmpeq_epi8(_mm_max_epu8(offset, limit), limit);
+}
+
+// ' ', '\t', '\n', '\v', '\f', '\r'
+static unsigned space_mask(const char *p)
+{
+    __m128i chars = _mm_loadu_si128((const __m128i *)p);
+    __m128i blank = _mm_cmpeq_epi8(chars, _mm_set1_epi8(' '));
+    return (unsigned)_mm_movemask_epi8(_mm_or_si128(blank, in_range(chars, '\t', 4)));
+}
+
+// [A-Za-z0-9]
+static unsigned alnum_mask(const char *p)
+{
+    __m128i chars = _mm_loadu_si128((const __m128i *)p);
+    __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+    __m128i alnum = _mm_or_si128(in_range(lower, 'a', 25), in_range(chars, '0', 9));
+    return (unsigned)_mm_movemask_epi8(alnum);
+}
+
+#endif
+
+// Position of the first non-whitespace character at or after position
+static int skip_space(const char *expression, int position, int length)
+{
+#ifdef SCANNER_SSE2
+    // 16 bytes at a time
+    while (position + 16 <= length) {
+        unsigned mask = ~space_mask(expression + position) & 0xFFFF;
+        if (mask)
+            return position + first_set_bit(mask);
+        position += 16;
     }
-    list->size++;
+#endif
+    while (position < length && is_class(expression[position], CHAR_SPACE))
+        position++;
+    return position;
 }
 
-TokenListNode *remove_last(TokenList *list)
+// Position of the first character that cannot continue an identifier
+static int skip_alnum(const char *expression, int position, int length)
 {
-    if (list->tail == NULL)
-        return NULL;
-    TokenListNode *temp = NULL;
-    if (list->head == list->tail) { // only one node
-        temp = list->head;
-        list->head = NULL;
-        list->tail = NULL;
-    } else {
-        temp = list->tail;
-        list->tail = temp->prev;
-        list->tail->next = NULL;
+#ifdef SCANNER_SSE2
+    while (position + 16 <= length) {
+        unsigned mask = ~alnum_mask(expression + position) & 0xFFFF;
+        if (mask)
+            return position + first_set_bit(mask);
+        position += 16;
     }
-    list->size--;
-    return temp;
+#endif
+    while (position < length && is_class(expression[position], CHAR_ALPHA | CHAR_DIGIT))
+        position++;
+    return position;
 }
 
-Scanner *create_scanner(const char *expression)
+Scanner *create_scanner(const char *expression, Diagnostics *diagnostics, Arena *arena)
 {
-    Scanner *scanner = (Scanner *)malloc(sizeof(Scanner));
-    scanner->token_list = create_list();
-    scanner->expression = expression;
-    scanner->status = 1;
+    Scanner *scanner = (Scanner *)arena_alloc(arena, sizeof(Scanner));
+    scanner->arena = arena;
+    scanner->token_list = create_list(arena);
+    scanner->diagnostics = diagnostics;
+    reset_scanner(scanner, expression, strlen(expression));
     return scanner;
 }
 
-// 当新增加数字到 Token 链表时, 处理是否存在符号
-// void process_sign(Scanner* scanner) {
-//     // printf("FUNCTION %-15s: current: %s\n", __func__,
-//     //     scanner->token_list->tail->token->literal);
-//     TokenListNode* last1st = NULL;
-//     TokenListNode* last2nd = NULL;
-//     TokenListNode* last3rd = NULL;
-//     last1st = scanner->token_list->tail; // new INTEGER token
-//     last2nd = last1st->prev;
-
-//     if (!last2nd || (last2nd->token->type != PLUS &&
-//             last2nd->token->type != MINUS))
-//         return;
-
-//     last3rd = last2nd->prev;
-//     if (last3rd) {
-//         Token* t = last3rd->token;
-//         if (!(t->type == LPAREN || t->type == PLUS ||
-//                 t->type == MINUS || t->type == MULT ||
-//                 t->type == DIV)) {
-//             return;
-//         }
-//     }
-
-//     //创建新 INTEGER Token, 并删除原来的最后两个 Token
-//     int position = last2nd->token->position;
-//     int size = strlen(last1st->token->literal) +
-//         strlen(last2nd->token->literal);
-
-//     int type = last1st->token->type;
-//     Token* token = create_token(type, scanner->expression, position, size);
-//     remove_last(scanner->token_list);
-//     free_list_node(last1st);
-//     remove_last(scanner->token_list);
-//     free_list_node(last2nd);
-//     append_token(scanner->token_list, create_list_node(token));
-// }
+void reset_scanner(Scanner *scanner, const char *expression, int length)
+{
+    scanner->token_list->size = 0; // keep the storage
+    scanner->expression = expression;
+    scanner->length = length;
+    scanner->position = 0;
+    scanner->status = 1;
+}
 
-void tokonize(Scanner *scanner)
+Token next_token(Scanner *scanner)
 {
     const char *expression = scanner->expression;
 
-    int position = 0;
-    int expression_len = strlen(expression);
+    int position = scanner->position;
+    int expression_len = scanner->length;
 
-    Token *token = NULL;
     while (position < expression_len) {
         // Skip whitespace
-        if (isspace(expression[position])) {
-            position++;
+        if (is_class(expression[position], CHAR_SPACE)) {
+            position = skip_space(expression, position, expression_len);
             continue;
         }
 
-        token = NULL;
         TokenType type = EOL;
         int start = position;
+        double number = 0.0;
+        long long integer = 0;
+        int symbol = SYMBOL_UNKNOWN;
         char ch = expression[position];
-        if (isalpha(ch)) {
+        if (is_class(ch, CHAR_ALPHA)) {
             // Parse identifier literal
-            while (isalpha(expression[position]) || isdigit(expression[position])) {
-                position++;
-            }
+            position = skip_alnum(expression, position + 1, expression_len);
+            symbol = intern_symbol(expression + start, position - start);
             type = ID;
-        } else if (isdigit(ch) || ch == '.') {
+        } else if (is_class(ch, CHAR_DIGIT) || ch == '.') {
             // Parse number literal
             const char *str = expression + position;
-            char *endptr;
-            double result = strtod(str, &endptr);
+            const char *end = expression + expression_len;
+            const char *endptr;
+            double result;
+            NumberStatus status = parse_number(str, end, &endptr, &result);
 
             // 检查合法性
-            if (endptr == str) { // for example: "."
-                fprintf(stderr, "Syntax Error: Illeagal number at position: %d.\n", start + 1);
+            if (status == NUMBER_INVALID) { // for example: "."
+                report_diagnostic(scanner->diagnostics, DIAG_ILLEGAL_NUMBER, start, 1);
                 position++; // advance
                 type = ERROR;
             } else {
-                if (errno == ERANGE) {
-                    if (fabs(result) < DBL_MIN) {
-                        fprintf(stderr, "Syntax Error: Numerical underflow at position: %d.\n", start + 1);
-                    } else if (isinf(result)) {
-                        fprintf(stderr, "Syntax Error: Numerical overflow at position: %d.\n", start + 1);
-                    }
-                    errno = 0; // reset
+                if (status == NUMBER_UNDERFLOW) {
+                    report_diagnostic(scanner->diagnostics, DIAG_NUMBER_UNDERFLOW,
+                        start, (int)(endptr - str));
+                    type = ERROR;
+                } else if (status == NUMBER_OVERFLOW) {
+                    report_diagnostic(scanner->diagnostics, DIAG_NUMBER_OVERFLOW,
+                        start, (int)(endptr - str));
                     type = ERROR;
                 } else {
                     type = INTEGER;
@@ -231,6 +264,13 @@ void tokonize(Scanner *scanner)
                             break;
                         }
                     }
+                    // Decode once here, the evaluator reads the value
+                    if (type == INTEGER) {
+                        integer = parse_integer(str, endptr); // saturates
+                        number = (double)integer;
+                    } else {
+                        number = result;
+                    }
                 }
                 position = (endptr - str) + start; // advance
             }
@@ -259,9 +299,8 @@ void tokonize(Scanner *scanner)
                 type = RPAREN;
                 break;
             default:
-                fprintf(stderr,
-                    "Syntax Error: Illeagal character: '%c' at position: %d.\n",
-                    ch, position + 1);
+                report_diagnostic(scanner->diagnostics, DIAG_ILLEGAL_CHARACTER,
+                    position, 1);
             }
             // Don't stop the scanner even encountering error
             // and advance past the char
@@ -272,24 +311,111 @@ void tokonize(Scanner *scanner)
             scanner->status = 0;
         }
 
-        // Append to list
+        // Emit the token, errors are skipped
         if (type != EOL && type != ERROR) {
-            token = create_token(type, expression, start, position - start);
-            append_token(scanner->token_list, create_list_node(token));
-            // if (type == FLOAT || type == INTEGER) { // 处理是否存在符号
-            //     process_sign(scanner);
-            // }
+            Token token = create_token(type, start, position - start);
+            token.symbol = symbol;
+            token.number = number;
+            token.integer = integer;
+            scanner->position = position;
+            return token;
         }
     }
 
-    // Add EOL token
-    token = create_eol_token(position);
-    append_token(scanner->token_list, create_list_node(token));
+    scanner->position = position;
+    return create_eol_token(position);
+}
+
+void tokonize(Scanner *scanner)
+{
+    Token token;
+    do {
+        token = next_token(scanner);
+        append_token(scanner->token_list, token);
+    } while (token.type != EOL);
 }
 
 void free_scanner(Scanner *scanner)
 {
-    if (scanner)
-        free_list(scanner->token_list);
-    free(scanner);
-}
\ No newline at end of file
+    if (scanner == NULL)
+        return;
+    free_list(scanner->token_list);
+    arena_free(scanner->arena, scanner);
+}
+
+// A lexeme may look this many characters past its end, as in "1e+x"
+#define RESCAN_MARGIN 3
+
+void retokenize(Scanner *scanner, const char *expression,
+    int offset, int removed, int inserted)
+{
+    TokenList *list = scanner->token_list;
+    scanner->expression = expression;
+    scanner->length += inserted - removed;
+
+    // A malformed number clears status, which a partial rescan could not
+    // set again, so start over after one. Illegal characters leave status
+    // alone: they produce no token and the kept tokens don't depend on them.
+    if (!scanner->status || list->size == 0) {
+        list->size = 0;
+        scanner->position = 0;
+        scanner->status = 1;
+        tokonize(scanner);
+        return;
+    }
+
+    // Tokens ending well before the edit are kept as they are,
+    // binary search for the first one that is not
+    int first = 0;
+    int last = list->size - 1; // EOL is never kept
+    while (first < last) {
+        int middle = first + (last - first) / 2;
+        Token *token = &list->tokens[middle];
+        if (token->position + token->length + RESCAN_MARGIN > offset)
+            last = middle;
+        else
+            first = middle + 1;
+    }
+    if (first > 0) {
+        Token *last = &list->tokens[first - 1];
+        scanner->position = last->position + last->length;
+    } else {
+        scanner->position = 0;
+    }
+
+    // Rescan until a token starts where an old one did, behind the edit.
+    // Scanning never looks back, so the rest of the old tokens are valid.
+    int delta = inserted - removed;
+    int resume = first;
+    TokenList *fresh = create_list(NULL); // short-lived, kept off the arena
+    for (;;) {
+        Token token = next_token(scanner);
+        if (token.position >= offset + inserted) {
+            while (resume < list->size
+                && list->tokens[resume].position + delta < token.position)
+                resume++;
+            if (resume < list->size
+                && list->tokens[resume].position + delta == token.position)
+                break;
+        }
+        append_token(fresh, token);
+        if (token.type == EOL) {
+            resume = list->size;
+            break;
+        }
+    }
+
+    // Splice: old [first, resume) becomes the fresh tokens, the tail shifts
+    int tail = list->size - resume;
+    int size = first + fresh->size + tail;
+    reserve_tokens(list, size);
+    memmove(&list->tokens[first + fresh->size], &list->tokens[resume],
+        tail * sizeof(Token));
+    memcpy(&list->tokens[first], fresh->tokens, fresh->size * sizeof(Token));
+    for (int i = first + fresh->size; i < size; i++) {
+        list->tokens[i].position += delta;
+    }
+    list->size = size;
+    scanner->position = scanner->length;
+    free_list(fresh);
+}
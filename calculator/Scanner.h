@@ -1,6 +1,9 @@
 #ifndef SCANNER_H
 #define SCANNER_H
 
+#include "Arena.h"
+#include "Diagnostics.h"
+
 // Token types
 typedef enum {
     ERROR,
@@ -32,48 +35,56 @@ static const char *TokenName[] = {
     "EOL"
 };
 
-// Token structure - with position info
+// Token structure - a view into the expression, the literal is not copied
 typedef struct {
     TokenType type;
     int position; // start position in expression
-    char *literal; // token literal
+    int length; // literal length
+    int symbol; // builtin symbol id of ID tokens, see Symbol.h
+    double number; // decoded value of FLOAT and INTEGER tokens
+    long long integer; // exact value of INTEGER tokens
 } Token;
 
-Token *create_token(TokenType type, const char *src,
-    int position, int size);
-Token *create_eol_token();
-void free_token(Token *token);
-
-// Toke node for token list
-typedef struct TokenListNode {
-    Token *token;
-    struct TokenListNode *next;
-    struct TokenListNode *prev;
-} TokenListNode;
+Token create_token(TokenType type, int position, int size);
+Token create_eol_token(int position);
 
+// Token list - tokens are stored contiguously in a growable array
 typedef struct TokenList {
-    TokenListNode *head;
-    TokenListNode *tail;
+    Token *tokens;
+    Arena *arena; // where tokens are allocated, NULL for the heap
     int size;
+    int capacity;
 } TokenList;
 
-TokenList *create_list();
-TokenListNode *create_list_node(Token *token);
-void free_list_node(TokenListNode *node);
+TokenList *create_list(Arena *arena);
 void free_list(TokenList *list);
-void print_list(TokenList *list);
-void append_token(TokenList *list, TokenListNode *node);
-TokenListNode *remove_last(TokenList *list);
+void print_list(const char *expression, TokenList *list);
+void append_token(TokenList *list, Token token);
 
 // Scanner
 typedef struct Scanner {
     const char *expression;
+    int length; // expression length
+    int position; // where next_token() resumes
     TokenList *token_list;
+    Arena *arena; // owns the scanner and its tokens, NULL for the heap
+    Diagnostics *diagnostics; // lexical errors go here, may be NULL
     int status; // 1 for success, 0 for failure
 } Scanner;
 
-Scanner *create_scanner(const char *expression);
+Scanner *create_scanner(const char *expression, Diagnostics *diagnostics, Arena *arena);
+// Scan another expression of length characters, no NUL terminator needed;
+// the token storage is reused
+void reset_scanner(Scanner *scanner, const char *expression, int length);
+// Scan one token on demand, EOL is returned at (and after) the end
+Token next_token(Scanner *scanner);
+// Scan the whole expression into the token list
 void tokonize(Scanner *scanner);
+// Update the token list of a previous tokonize() after an edit: expression
+// is the new text, in which `removed` characters at offset were replaced by
+// `inserted` ones. Only the damaged region is rescanned.
+void retokenize(Scanner *scanner, const char *expression,
+    int offset, int removed, int inserted);
 void free_scanner(Scanner *scanner);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,152 @@
+// #define _USE_MATH_DEFINES
+
+#include "Symbol.h"
+#include <math.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.1415926535897932384626434
+#endif
+#ifndef M_E
+#define M_E 2.7182818284590452353602875
+#endif
+#ifndef M_PHI
+#define M_PHI 1.6180339887498948482045868
+#endif
+
+#define MAX_NAME_LENGTH 8 // longer identifiers are never builtins
+
+// Ids are the positions, saved ASTs refer to them: append new symbols
+static const Symbol symbols[] = {
+    { "sin", SYMBOL_FUNCTION, 1, 1, sin, 0.0 },
+    { "cos", SYMBOL_FUNCTION, 1, 1, cos, 0.0 },
+    { "tan", SYMBOL_FUNCTION, 1, 1, tan, 0.0 },
+    { "asin", SYMBOL_FUNCTION, 1, 1, asin, 0.0 },
+    { "acos", SYMBOL_FUNCTION, 1, 1, acos, 0.0 },
+    { "atan", SYMBOL_FUNCTION, 1, 1, atan, 0.0 },
+    { "sinh", SYMBOL_FUNCTION, 1, 1, sinh, 0.0 },
+    { "cosh", SYMBOL_FUNCTION, 1, 1, cosh, 0.0 },
+    { "tanh", SYMBOL_FUNCTION, 1, 1, tanh, 0.0 },
+    { "asinh", SYMBOL_FUNCTION, 1, 1, asinh, 0.0 },
+    { "acosh", SYMBOL_FUNCTION, 1, 1, acosh, 0.0 },
+    { "atanh", SYMBOL_FUNCTION, 1, 1, atanh, 0.0 },
+    { "exp", SYMBOL_FUNCTION, 1, 1, exp, 0.0 },
+    { "log", SYMBOL_FUNCTION, 1, 1, log, 0.0 },
+    { "log10", SYMBOL_FUNCTION, 1, 1, log10, 0.0 },
+    { "log2", SYMBOL_FUNCTION, 1, 1, log2, 0.0 },
+    { "sqrt", SYMBOL_FUNCTION, 1, 1, sqrt, 0.0 },
+    { "cbrt", SYMBOL_FUNCTION, 1, 1, cbrt, 0.0 },
+    { "ceil", SYMBOL_FUNCTION, 1, 1, ceil, 0.0 },
+    { "floor", SYMBOL_FUNCTION, 1, 1, floor, 0.0 },
+    { "fabs", SYMBOL_FUNCTION, 1, 1, fabs, 0.0 },
+    { "ans", SYMBOL_VARIABLE, 0, 0, NULL, 0.0 },
+    { "pi", SYMBOL_CONSTANT, 0, 1, NULL, M_PI },
+    { "e", SYMBOL_CONSTANT, 0, 1, NULL, M_E },
+    { "phi", SYMBOL_CONSTANT, 0, 1, NULL, M_PHI },
+};
+
+#define SYMBOL_COUNT (int)(sizeof(symbols) / sizeof(symbols[0]))
+
+// Perfect hash of the case-folded names, every builtin has a slot of its
+// own. A new name needs a free slot, or other multipliers for all of them;
+// tests/symbol_test.c checks the table.
+#define SLOT_COUNT 64
+
+static unsigned symbol_slot(const char *folded, int length)
+{
+    // folded[1] is the NUL of a single letter
+    unsigned first = (unsigned char)folded[0] + (unsigned char)folded[1];
+    unsigned last = (unsigned char)folded[length - 1] + (unsigned)length;
+    return (first + 6 * last) & (SLOT_COUNT - 1);
+}
+
+// Slot to id + 1, 0 for a free slot
+static const signed char slots[SLOT_COUNT] = {
+    [0] = 3 + 1, // asin
+    [1] = 5 + 1, // atan
+    [2] = 0 + 1, // sin
+    [9] = 23 + 1, // e
+    [14] = 4 + 1, // acos
+    [15] = 12 + 1, // exp
+    [17] = 20 + 1, // fabs
+    [18] = 10 + 1, // acosh
+    [19] = 21 + 1, // ans
+    [21] = 17 + 1, // cbrt
+    [22] = 1 + 1, // cos
+    [23] = 13 + 1, // log
+    [25] = 14 + 1, // log10
+    [26] = 7 + 1, // cosh
+    [27] = 22 + 1, // pi
+    [28] = 19 + 1, // floor
+    [29] = 8 + 1, // tanh
+    [31] = 15 + 1, // log2
+    [32] = 24 + 1, // phi
+    [34] = 9 + 1, // asinh
+    [35] = 11 + 1, // atanh
+    [36] = 6 + 1, // sinh
+    [40] = 18 + 1, // ceil
+    [52] = 16 + 1, // sqrt
+    [59] = 2 + 1, // tan
+};
+
+static char fold_case(char ch)
+{
+    return (ch >= 'A' && ch <= 'Z') ? (char)(ch - 'A' + 'a') : ch;
+}
+
+// One hash and one compare
+int intern_symbol(const char *name, int length)
+{
+    if (length <= 0 || length > MAX_NAME_LENGTH)
+        return SYMBOL_UNKNOWN;
+
+    // Case-fold once, identifiers are ASCII letters and digits
+    char folded[MAX_NAME_LENGTH + 1];
+    for (int i = 0; i < length; i++)
+        folded[i] = fold_case(name[i]);
+    folded[length] = '\0';
+
+    int id = slots[symbol_slot(folded, length)] - 1;
+    if (id < 0 || strcmp(symbols[id].name, folded) != 0)
+        return SYMBOL_UNKNOWN;
+    return id;
+}
+
+int complete_symbol(const char *prefix, int length, int *ids, int capacity)
+{
+    int count = 0;
+    for (int id = 0; id < SYMBOL_COUNT; id++) {
+        const char *name = symbols[id].name;
+        int i = 0;
+        while (i < length && name[i] == fold_case(prefix[i]))
+            i++;
+        if (i < length)
+            continue;
+        if (count < capacity)
+            ids[count] = id;
+        count++;
+    }
+    return count;
+}
+
+const Symbol *get_symbol(int id)
+{
+    return &symbols[id];
+}
+
+int symbol_count()
+{
+    return SYMBOL_COUNT;
+}
+
+// FNV-1a
+unsigned symbol_table_hash()
+{
+    unsigned hash = 2166136261u;
+    for (int id = 0; id < SYMBOL_COUNT; id++) {
+        for (const char *p = symbols[id].name; *p; p++)
+            hash = (hash ^ (unsigned char)*p) * 16777619u;
+        hash = (hash ^ (unsigned)symbols[id].kind) * 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,43 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+// Builtin symbols: functions, constants and the 'ans' variable. The
+// scanner resolves every identifier to a symbol id once, the parser and
+// the evaluator only work with ids.
+
+typedef enum {
+    SYMBOL_FUNCTION, // name ( expr )
+    SYMBOL_CONSTANT, // fixed value
+    SYMBOL_VARIABLE // value supplied by the calculator (ans)
+} SymbolKind;
+
+typedef struct Symbol {
+    const char *name; // lower case
+    SymbolKind kind;
+    int arity; // arguments, 1 for functions and 0 otherwise
+    int pure; // same value every time, all but ans
+    double (*function)(double); // SYMBOL_FUNCTION
+    double value; // SYMBOL_CONSTANT
+} Symbol;
+
+#define SYMBOL_UNKNOWN -1
+
+// Case-insensitive lookup with a perfect hash, SYMBOL_UNKNOWN if the name
+// is not a builtin
+int intern_symbol(const char *name, int length);
+
+// Ids of the symbols whose names start with prefix, case-insensitive, for
+// completion. Returns the number of matches, at most capacity are stored.
+int complete_symbol(const char *prefix, int length, int *ids, int capacity);
+
+// Symbol by id, id must not be SYMBOL_UNKNOWN
+const Symbol *get_symbol(int id);
+
+// Ids are 0 .. symbol_count() - 1
+int symbol_count();
+
+// Hash of the names and kinds in id order, changes whenever an id would
+// refer to a different symbol (saved ASTs store ids)
+unsigned symbol_table_hash();
+
+#endif
@@ -3,15 +3,19 @@
 #include <string.h>
 // #define _GNU_SOURCE
 #include <math.h>
+#include <time.h>
 #ifdef USE_READLINE
 #include <readline/history.h>
 #include <readline/readline.h>
 #else
 #include "linenoise.h"
 #endif
+#include "AstFile.h"
 #include "Calculator.h"
+#include "ParsedLines.h"
 #include "Parser.h"
 #include "Scanner.h"
+#include "Symbol.h"
 #include "strext.h"
 
 #define HISTFILE ".repl_history" // 历史文件路径
@@ -37,17 +41,306 @@ void trim_zeros(char *buffer)
     }
 }
 
+// Whole file, NULL if it can't be opened
+char *read_file(const char *path, long *size)
+{
+    FILE *stream = fopen(path, "rb");
+    if (stream == NULL) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return NULL;
+    }
+    fseek(stream, 0, SEEK_END);
+    *size = ftell(stream);
+    fseek(stream, 0, SEEK_SET);
+    char *input = (char *)malloc(*size > 0 ? *size : 1);
+    *size = fread(input, 1, *size > 0 ? *size : 0, stream);
+    fclose(stream);
+    return input;
+}
+
+// Evaluate every line of a file in order, lines are parsed in parallel
+int run_file(const char *path)
+{
+    long size;
+    char *input = read_file(path, &size);
+    if (input == NULL)
+        return 1;
+
+    ParsedLines *parsed = parse_lines(input, size, 0);
+    Calculator *calculator = create_calculator();
+    calculator->diagnostics->mode = DIAGNOSTICS_COLLECT;
+    for (int i = 0; i < parsed->count; i++) {
+        ParsedLine *line = &parsed->lines[i];
+        // 空行跳过
+        if (line->ast.root == AST_NONE && line->status)
+            continue;
+        print_diagnostics(&line->diagnostics, stderr);
+        if (!line->status)
+            continue;
+
+        double ans = calculate_ast(calculator, line->expression, &line->ast);
+        print_diagnostics(calculator->diagnostics, stderr);
+        char buffer[64];
+        if (calculator->status) {
+            snprintf(buffer, sizeof(buffer), "%.16g", ans);
+            printf("ans: %s\n", buffer);
+        }
+    }
+
+    free_calculator(calculator);
+    free_parsed_lines(parsed);
+    free(input);
+    return 0;
+}
+
+// Parse every line of a file and save the expressions to an AST file,
+// lines with errors are reported and left out
+int save_file(const char *source, const char *path)
+{
+    long size;
+    char *input = read_file(source, &size);
+    if (input == NULL)
+        return 1;
+
+    ParsedLines *parsed = parse_lines(input, size, 0);
+    AstWriter *writer = create_ast_writer();
+    for (int i = 0; i < parsed->count; i++) {
+        ParsedLine *line = &parsed->lines[i];
+        print_diagnostics(&line->diagnostics, stderr);
+        if (line->status)
+            add_ast(writer, line->expression, line->length, &line->ast);
+    }
+    int saved = save_ast_file(writer, path);
+    if (saved)
+        printf("%d expressions saved to %s\n", writer->count, path);
+    else
+        fprintf(stderr, "Cannot write %s\n", path);
+
+    free_ast_writer(writer);
+    free_parsed_lines(parsed);
+    free(input);
+    return !saved;
+}
+
+// Evaluate the expressions of an AST file in order, without parsing
+int run_saved(const char *path)
+{
+    AstFile *file = load_ast_file(path);
+    if (file == NULL) {
+        fprintf(stderr, "Cannot load %s\n", path);
+        return 1;
+    }
+
+    Calculator *calculator = create_calculator();
+    calculator->diagnostics->mode = DIAGNOSTICS_COLLECT;
+    int status = 0;
+    for (int i = 0; i < file->count; i++) {
+        Ast ast;
+        int length;
+        const char *text = get_ast_text(file, i, &length);
+        if (!get_ast(file, i, &ast)) {
+            fprintf(stderr, "Damaged expression %d in %s\n", i, path);
+            status = 1;
+            continue;
+        }
+
+        double ans = calculate_ast(calculator, text, &ast);
+        print_diagnostics(calculator->diagnostics, stderr);
+        char buffer[64];
+        if (calculator->status) {
+            snprintf(buffer, sizeof(buffer), "%.16g", ans);
+            printf("ans: %s\n", buffer);
+        }
+    }
+
+    free_calculator(calculator);
+    free_ast_file(file);
+    return status;
+}
+
+#define BENCH_PARSES 2000000 // lines, spread over the file
+
+// Time scanning and parsing alone on every line of a file, as
+// calculator_reset() does without folding, in lines and nodes per second
+int run_parse_bench(const char *path)
+{
+    long size;
+    char *input = read_file(path, &size);
+    if (input == NULL)
+        return 1;
+
+    ParsedLines *parsed = parse_lines(input, size, 1); // for the line ends
+    Calculator *calculator = create_calculator();
+    calculator->diagnostics->mode = DIAGNOSTICS_COLLECT;
+    calculator->fold = 0;
+    int status = 0;
+    if (parsed->count == 0) {
+        printf("No expressions\n");
+        status = 1;
+    } else {
+        int rounds = BENCH_PARSES / parsed->count + 1;
+        long nodes = 0;
+        clock_t start = clock();
+        for (int round = 0; round < rounds; round++) {
+            for (int i = 0; i < parsed->count; i++) {
+                ParsedLine *line = &parsed->lines[i];
+                calculator_reset(calculator, line->expression, line->length);
+                nodes += calculator->parser->ast->size;
+            }
+        }
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        long lines = (long)rounds * parsed->count;
+        printf("%d lines, %d rounds\n", parsed->count, rounds);
+        printf("%.1f ns per line, %.1f nodes per line, %.1f M nodes/s\n",
+            seconds * 1e9 / lines, (double)nodes / lines, nodes / seconds / 1e6);
+    }
+
+    free_calculator(calculator);
+    free_parsed_lines(parsed);
+    free(input);
+    return status;
+}
+
+#define BENCH_EVALUATIONS 2000000 // per engine, spread over the lines
+#define ENGINE_COUNT 4
+
+// Instructions, closures or bytes of machine code
+int program_size(const Program *program)
+{
+    switch (program->engine) {
+    case ENGINE_BYTECODE:
+        return program->code.bytecode->size;
+    case ENGINE_REGISTER:
+        return program->code.registers->size;
+    case ENGINE_CLOSURE:
+        return program->code.closures->size;
+    case ENGINE_JIT:
+        return (int)program->code.jit->size;
+    }
+    return 0;
+}
+
+// Time the tree sweep and every engine on count compiled lines, returns
+// 1 if an engine gives another result than the sweep, where any NaN
+// matches any NaN
+int time_engines(Calculator *calculator, ParsedLine **lines, Program **programs,
+    int count, const long *instructions)
+{
+    static const char *engine_names[ENGINE_COUNT] = { "bytecode", "register", "closure", "jit" };
+    int rounds = BENCH_EVALUATIONS / count + 1;
+    int failed = 0;
+    double tree = 0.0, sum = 0.0;
+    clock_t start = clock();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < count; i++) {
+            calculator->ans = 1.0; // the same ans for every engine
+            sum += calculate_ast(calculator, lines[i]->expression, &lines[i]->ast);
+        }
+    }
+    tree = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("%d expressions, %d rounds\n", count, rounds);
+    printf("%-9s %8.1f ns\n", "tree", tree * 1e9 / ((double)rounds * count));
+
+    for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+        int mismatches = 0;
+        start = clock();
+        for (int round = 0; round < rounds; round++) {
+            for (int i = 0; i < count; i++) {
+                calculator->ans = 1.0;
+                sum += calculator_run(calculator, programs[i * ENGINE_COUNT + engine]);
+            }
+        }
+        double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+        for (int i = 0; i < count; i++) {
+            calculator->ans = 1.0;
+            double expected = calculate_ast(calculator, lines[i]->expression, &lines[i]->ast);
+            calculator->ans = 1.0;
+            double actual = calculator_run(calculator, programs[i * ENGINE_COUNT + engine]);
+            if (isnan(expected) && isnan(actual))
+                continue;
+            if (memcmp(&expected, &actual, sizeof(double)) != 0)
+                mismatches++;
+        }
+        failed |= mismatches != 0;
+        printf("%-9s %8.1f ns, %.1f instructions, %d mismatches\n", engine_names[engine],
+            seconds * 1e9 / ((double)rounds * count), (double)instructions[engine] / count, mismatches);
+    }
+    printf("(checksum %g)\n", sum);
+    return failed;
+}
+
+// Time the evaluators on every valid line of a file: the tree sweep of
+// calculate() and each engine of calculator_compile(). Fails if an engine
+// gives another result than the sweep or there is nothing to time.
+int run_bench(const char *path)
+{
+    long size;
+    char *input = read_file(path, &size);
+    if (input == NULL)
+        return 1;
+
+    ParsedLines *parsed = parse_lines(input, size, 0);
+    Calculator *calculator = create_calculator();
+    calculator->diagnostics->mode = DIAGNOSTICS_COLLECT;
+    ParsedLine **lines = (ParsedLine **)malloc((parsed->count + 1) * sizeof(ParsedLine *));
+    Program **programs = (Program **)malloc((parsed->count + 1) * ENGINE_COUNT * sizeof(Program *));
+    int count = 0;
+    long instructions[ENGINE_COUNT] = { 0 };
+    for (int i = 0; i < parsed->count; i++) {
+        ParsedLine *line = &parsed->lines[i];
+        if (!line->status || line->ast.root == AST_NONE)
+            continue;
+        for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+            Program *program = compile_program(&line->ast, (Engine)engine);
+            instructions[engine] += program_size(program);
+            programs[count * ENGINE_COUNT + engine] = program;
+        }
+        lines[count++] = line;
+    }
+    int failed = 1;
+    if (count == 0)
+        printf("No expressions\n");
+    else
+        failed = time_engines(calculator, lines, programs, count, instructions);
+
+    for (int i = 0; i < count * ENGINE_COUNT; i++)
+        free_program(programs[i]);
+    free(programs);
+    free(lines);
+    free_calculator(calculator);
+    free_parsed_lines(parsed);
+    free(input);
+    return failed;
+}
+
 #ifdef USE_READLINE
 int main(int argc, char *argv[])
 {
     char *line;
     int histfile = 0; // 历史文件扩展名
 
+    // calc file: evaluate each line of file
+    // calc --bench file: time the evaluators
+    // calc --bench-parse file: time the scanner and the parser
+    // calc --save out.ast file: parse each line of file once into out.ast
+    // calc --load out.ast: evaluate the expressions saved in out.ast
+    if (argc > 2 && strcmp(argv[1], "--bench") == 0)
+        return run_bench(argv[2]);
+    if (argc > 2 && strcmp(argv[1], "--bench-parse") == 0)
+        return run_parse_bench(argv[2]);
+    if (argc > 3 && strcmp(argv[1], "--save") == 0)
+        return save_file(argv[3], argv[2]);
+    if (argc > 2 && strcmp(argv[1], "--load") == 0)
+        return run_saved(argv[2]);
+    if (argc > 1)
+        return run_file(argv[1]);
+
     // 读取历史文件
     read_history(HISTFILE);
     stifle_history(MAX_HIST); // 限制历史大小
 
     Calculator *calculator = create_calculator();
+    calculator->diagnostics->mode = DIAGNOSTICS_COLLECT; // print once per line
 
     printf("Welcome to the expression calculator!\nEnter 'exit' to exit.\n");
 
@@ -75,10 +368,11 @@ int main(int argc, char *argv[])
         recreate_parser(calculator, line);
 
         double ans = calculate(calculator);
+        print_diagnostics(calculator->diagnostics, stderr);
         char buffer[64];
         if (calculator->status) {
             // printf("Postfix notation: ");
-            // print_ast(calculator->parser->ast);
+            // print_ast(line, calculator->parser->ast);
             snprintf(buffer, sizeof(buffer), "%.16g", ans);
             printf("ans: %s\n", buffer);
         }
@@ -94,16 +388,47 @@ int main(int argc, char *argv[])
     return 0;
 }
 #else
+// Tab completion of builtin names, a function gets its parenthesis
+void complete_builtin(const char *prefix, linenoiseCompletions *completions)
+{
+    int ids[64];
+    int count = complete_symbol(prefix, (int)strlen(prefix), ids, 64);
+    for (int i = 0; i < count && i < 64; i++) {
+        const Symbol *symbol = get_symbol(ids[i]);
+        char name[32];
+        snprintf(name, sizeof(name), "%s%s", symbol->name, symbol->arity > 0 ? "(" : "");
+        linenoiseAddCompletion(completions, name);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     char *line;
     int histfile = 0; // 历史文件扩展名
 
+    // calc file: evaluate each line of file
+    // calc --bench file: time the evaluators
+    // calc --bench-parse file: time the scanner and the parser
+    // calc --save out.ast file: parse each line of file once into out.ast
+    // calc --load out.ast: evaluate the expressions saved in out.ast
+    if (argc > 2 && strcmp(argv[1], "--bench") == 0)
+        return run_bench(argv[2]);
+    if (argc > 2 && strcmp(argv[1], "--bench-parse") == 0)
+        return run_parse_bench(argv[2]);
+    if (argc > 3 && strcmp(argv[1], "--save") == 0)
+        return save_file(argv[3], argv[2]);
+    if (argc > 2 && strcmp(argv[1], "--load") == 0)
+        return run_saved(argv[2]);
+    if (argc > 1)
+        return run_file(argv[1]);
+
     // 初始化：设置最大长度，加载历史
     linenoiseHistorySetMaxLen(MAX_HIST);
     linenoiseHistoryLoad(HISTFILE);
+    linenoiseSetCompletionCallback(complete_builtin);
 
     Calculator *calculator = create_calculator();
+    calculator->diagnostics->mode = DIAGNOSTICS_COLLECT; // print once per line
 
     printf("Welcome to the expression calculator!\nEnter 'exit' to exit.\n");
 
@@ -131,10 +456,11 @@ int main(int argc, char *argv[])
         recreate_parser(calculator, line);
 
         double ans = calculate(calculator);
+        print_diagnostics(calculator->diagnostics, stderr);
         char buffer[64];
         if (calculator->status) {
             // printf("Postfix notation: ");
-            // print_ast(calculator->parser->ast);
+            // print_ast(line, calculator->parser->ast);
             snprintf(buffer, sizeof(buffer), "%.16g", ans);
             printf("ans: %s\n", buffer);
         }
@@ -0,0 +1,422 @@
+// Up to 19 significant digits are accumulated into a 64-bit mantissa,
+// eight at a time with SWAR arithmetic. The value is then rounded by the
+// first of these that applies:
+//  1. Clinger's fast path: mantissa and power of ten are both exact
+//     doubles, so one IEEE multiplication or division is correctly rounded.
+//  2. Eisel-Lemire: multiply by a 128-bit approximation of 5^q and keep the
+//     result when the truncation provably cannot affect rounding. The table
+//     only covers 10^-27 .. 10^55, where one extra product always suffices.
+//  3. strtod() on a NUL-terminated copy of the literal, which also handles
+//     long mantissas, overflow and underflow.
+
+#include "number.h"
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NUMBER_SWAR 1
+#elif defined(_M_X64) || defined(_M_IX86) || defined(_M_ARM64)
+#define NUMBER_SWAR 1
+#endif
+
+#define MAX_DIGITS 19 // 10^19 - 1 < 2^64
+#define MAX_EXPONENT 100000 // far beyond the double range
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+
+// Powers of ten exactly representable as doubles
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+#define MAX_EXACT_POWER 22
+
+// Truncated 128-bit normalized powers of five: high word, low word
+#define MIN_TABLE_POWER -27
+#define MAX_TABLE_POWER 55
+static const uint64_t powers_of_five[] = {
+    0x9E74D1B791E07E48ULL, 0x775EA264CF55347EULL, // 5^-27
+    0xC612062576589DDAULL, 0x95364AFE032A819EULL, // 5^-26
+    0xF79687AED3EEC551ULL, 0x3A83DDBD83F52205ULL, // 5^-25
+    0x9ABE14CD44753B52ULL, 0xC4926A9672793543ULL, // 5^-24
+    0xC16D9A0095928A27ULL, 0x75B7053C0F178294ULL, // 5^-23
+    0xF1C90080BAF72CB1ULL, 0x5324C68B12DD6339ULL, // 5^-22
+    0x971DA05074DA7BEEULL, 0xD3F6FC16EBCA5E04ULL, // 5^-21
+    0xBCE5086492111AEAULL, 0x88F4BB1CA6BCF585ULL, // 5^-20
+    0xEC1E4A7DB69561A5ULL, 0x2B31E9E3D06C32E6ULL, // 5^-19
+    0x9392EE8E921D5D07ULL, 0x3AFF322E62439FD0ULL, // 5^-18
+    0xB877AA3236A4B449ULL, 0x09BEFEB9FAD487C3ULL, // 5^-17
+    0xE69594BEC44DE15BULL, 0x4C2EBE687989A9B4ULL, // 5^-16
+    0x901D7CF73AB0ACD9ULL, 0x0F9D37014BF60A11ULL, // 5^-15
+    0xB424DC35095CD80FULL, 0x538484C19EF38C95ULL, // 5^-14
+    0xE12E13424BB40E13ULL, 0x2865A5F206B06FBAULL, // 5^-13
+    0x8CBCCC096F5088CBULL, 0xF93F87B7442E45D4ULL, // 5^-12
+    0xAFEBFF0BCB24AAFEULL, 0xF78F69A51539D749ULL, // 5^-11
+    0xDBE6FECEBDEDD5BEULL, 0xB573440E5A884D1CULL, // 5^-10
+    0x89705F4136B4A597ULL, 0x31680A88F8953031ULL, // 5^-9
+    0xABCC77118461CEFCULL, 0xFDC20D2B36BA7C3EULL, // 5^-8
+    0xD6BF94D5E57A42BCULL, 0x3D32907604691B4DULL, // 5^-7
+    0x8637BD05AF6C69B5ULL, 0xA63F9A49C2C1B110ULL, // 5^-6
+    0xA7C5AC471B478423ULL, 0x0FCF80DC33721D54ULL, // 5^-5
+    0xD1B71758E219652BULL, 0xD3C36113404EA4A9ULL, // 5^-4
+    0x83126E978D4FDF3BULL, 0x645A1CAC083126EAULL, // 5^-3
+    0xA3D70A3D70A3D70AULL, 0x3D70A3D70A3D70A4ULL, // 5^-2
+    0xCCCCCCCCCCCCCCCCULL, 0xCCCCCCCCCCCCCCCDULL, // 5^-1
+    0x8000000000000000ULL, 0x0000000000000000ULL, // 5^0
+    0xA000000000000000ULL, 0x0000000000000000ULL, // 5^1
+    0xC800000000000000ULL, 0x0000000000000000ULL, // 5^2
+    0xFA00000000000000ULL, 0x0000000000000000ULL, // 5^3
+    0x9C40000000000000ULL, 0x0000000000000000ULL, // 5^4
+    0xC350000000000000ULL, 0x0000000000000000ULL, // 5^5
+    0xF424000000000000ULL, 0x0000000000000000ULL, // 5^6
+    0x9896800000000000ULL, 0x0000000000000000ULL, // 5^7
+    0xBEBC200000000000ULL, 0x0000000000000000ULL, // 5^8
+    0xEE6B280000000000ULL, 0x0000000000000000ULL, // 5^9
+    0x9502F90000000000ULL, 0x0000000000000000ULL, // 5^10
+    0xBA43B74000000000ULL, 0x0000000000000000ULL, // 5^11
+    0xE8D4A51000000000ULL, 0x0000000000000000ULL, // 5^12
+    0x9184E72A00000000ULL, 0x0000000000000000ULL, // 5^13
+    0xB5E620F480000000ULL, 0x0000000000000000ULL, // 5^14
+    0xE35FA931A0000000ULL, 0x0000000000000000ULL, // 5^15
+    0x8E1BC9BF04000000ULL, 0x0000000000000000ULL, // 5^16
+    0xB1A2BC2EC5000000ULL, 0x0000000000000000ULL, // 5^17
+    0xDE0B6B3A76400000ULL, 0x0000000000000000ULL, // 5^18
+    0x8AC7230489E80000ULL, 0x0000000000000000ULL, // 5^19
+    0xAD78EBC5AC620000ULL, 0x0000000000000000ULL, // 5^20
+    0xD8D726B7177A8000ULL, 0x0000000000000000ULL, // 5^21
+    0x878678326EAC9000ULL, 0x0000000000000000ULL, // 5^22
+    0xA968163F0A57B400ULL, 0x0000000000000000ULL, // 5^23
+    0xD3C21BCECCEDA100ULL, 0x0000000000000000ULL, // 5^24
+    0x84595161401484A0ULL, 0x0000000000000000ULL, // 5^25
+    0xA56FA5B99019A5C8ULL, 0x0000000000000000ULL, // 5^26
+    0xCECB8F27F4200F3AULL, 0x0000000000000000ULL, // 5^27
+    0x813F3978F8940984ULL, 0x4000000000000000ULL, // 5^28
+    0xA18F07D736B90BE5ULL, 0x5000000000000000ULL, // 5^29
+    0xC9F2C9CD04674EDEULL, 0xA400000000000000ULL, // 5^30
+    0xFC6F7C4045812296ULL, 0x4D00000000000000ULL, // 5^31
+    0x9DC5ADA82B70B59DULL, 0xF020000000000000ULL, // 5^32
+    0xC5371912364CE305ULL, 0x6C28000000000000ULL, // 5^33
+    0xF684DF56C3E01BC6ULL, 0xC732000000000000ULL, // 5^34
+    0x9A130B963A6C115CULL, 0x3C7F400000000000ULL, // 5^35
+    0xC097CE7BC90715B3ULL, 0x4B9F100000000000ULL, // 5^36
+    0xF0BDC21ABB48DB20ULL, 0x1E86D40000000000ULL, // 5^37
+    0x96769950B50D88F4ULL, 0x1314448000000000ULL, // 5^38
+    0xBC143FA4E250EB31ULL, 0x17D955A000000000ULL, // 5^39
+    0xEB194F8E1AE525FDULL, 0x5DCFAB0800000000ULL, // 5^40
+    0x92EFD1B8D0CF37BEULL, 0x5AA1CAE500000000ULL, // 5^41
+    0xB7ABC627050305ADULL, 0xF14A3D9E40000000ULL, // 5^42
+    0xE596B7B0C643C719ULL, 0x6D9CCD05D0000000ULL, // 5^43
+    0x8F7E32CE7BEA5C6FULL, 0xE4820023A2000000ULL, // 5^44
+    0xB35DBF821AE4F38BULL, 0xDDA2802C8A800000ULL, // 5^45
+    0xE0352F62A19E306EULL, 0xD50B2037AD200000ULL, // 5^46
+    0x8C213D9DA502DE45ULL, 0x4526F422CC340000ULL, // 5^47
+    0xAF298D050E4395D6ULL, 0x9670B12B7F410000ULL, // 5^48
+    0xDAF3F04651D47B4CULL, 0x3C0CDD765F114000ULL, // 5^49
+    0x88D8762BF324CD0FULL, 0xA5880A69FB6AC800ULL, // 5^50
+    0xAB0E93B6EFEE0053ULL, 0x8EEA0D047A457A00ULL, // 5^51
+    0xD5D238A4ABE98068ULL, 0x72A4904598D6D880ULL, // 5^52
+    0x85A36366EB71F041ULL, 0x47A6DA2B7F864750ULL, // 5^53
+    0xA70C3C40A64E6C51ULL, 0x999090B65F67D924ULL, // 5^54
+    0xD0CF4B50CFE20765ULL, 0xFFF4B4E3F741CF6DULL, // 5^55
+};
+
+static int is_digit(char ch)
+{
+    return ch >= '0' && ch <= '9';
+}
+
+#ifdef NUMBER_SWAR
+
+static uint64_t load_eight(const char *p)
+{
+    uint64_t chunk;
+    memcpy(&chunk, p, sizeof(chunk));
+    return chunk;
+}
+
+// All eight bytes are within '0'..'9'
+static int is_eight_digits(uint64_t chunk)
+{
+    return !(((chunk + 0x4646464646464646ULL) | (chunk - 0x3030303030303030ULL))
+        & 0x8080808080808080ULL);
+}
+
+// Combine eight ASCII digits pairwise: 8 x 1 -> 4 x 2 -> 2 x 4 -> 1 x 8
+static uint32_t eight_digits_value(uint64_t chunk)
+{
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 0x000F424000000064ULL; // 100 + (1000000 << 32)
+    const uint64_t mul2 = 0x0000271000000001ULL; // 1 + (10000 << 32)
+    chunk -= 0x3030303030303030ULL;
+    chunk = (chunk * 10) + (chunk >> 8);
+    chunk = (((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t)chunk;
+}
+
+#endif
+
+typedef struct {
+    uint64_t mantissa;
+    int digits; // significant digits in mantissa
+    int exponent; // decimal exponent applied to mantissa
+    int truncated; // nonzero digits did not fit into mantissa
+} Decimal;
+
+// Accumulate a run of digits, fraction digits also scale the exponent
+static const char *scan_digits(Decimal *decimal, const char *p,
+    const char *end, int fraction)
+{
+    // Leading zeros are not significant
+    if (decimal->mantissa == 0) {
+        while (p < end && *p == '0') {
+            if (fraction)
+                decimal->exponent--;
+            p++;
+        }
+    }
+
+#ifdef NUMBER_SWAR
+    while (end - p >= 8 && decimal->digits + 8 <= MAX_DIGITS) {
+        uint64_t chunk = load_eight(p);
+        if (!is_eight_digits(chunk))
+            break;
+        decimal->mantissa = decimal->mantissa * 100000000 + eight_digits_value(chunk);
+        decimal->digits += 8;
+        if (fraction)
+            decimal->exponent -= 8;
+        p += 8;
+    }
+#endif
+
+    while (p < end && is_digit(*p)) {
+        if (decimal->digits < MAX_DIGITS) {
+            decimal->mantissa = decimal->mantissa * 10 + (*p - '0');
+            if (decimal->mantissa != 0)
+                decimal->digits++;
+            if (fraction)
+                decimal->exponent--;
+        } else {
+            if (!fraction)
+                decimal->exponent++;
+            if (*p != '0')
+                decimal->truncated = 1;
+        }
+        p++;
+    }
+    return p;
+}
+
+// Correctly rounded conversion, or 0 when the fast path does not apply
+static int fast_path(const Decimal *decimal, double *value)
+{
+    if (decimal->mantissa == 0) {
+        *value = 0.0;
+        return 1;
+    }
+    if (decimal->truncated || decimal->mantissa > MAX_EXACT_MANTISSA)
+        return 0;
+
+    int exponent = decimal->exponent;
+    uint64_t mantissa = decimal->mantissa;
+    if (exponent < -MAX_EXACT_POWER)
+        return 0;
+    if (exponent < 0) {
+        *value = (double)mantissa / exact_powers[-exponent];
+        return 1;
+    }
+    // Shift surplus powers of ten into the mantissa while it stays exact
+    while (exponent > MAX_EXACT_POWER) {
+        if (mantissa > MAX_EXACT_MANTISSA / 10)
+            return 0;
+        mantissa *= 10;
+        exponent--;
+    }
+    *value = (double)mantissa * exact_powers[exponent];
+    return 1;
+}
+
+typedef struct {
+    uint64_t high;
+    uint64_t low;
+} Product;
+
+static Product multiply(uint64_t a, uint64_t b)
+{
+    Product product;
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128)a * b;
+    product.high = (uint64_t)(r >> 64);
+    product.low = (uint64_t)r;
+#else
+    uint64_t a_lo = (uint32_t)a, a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b, b_hi = b >> 32;
+    uint64_t lo_lo = a_lo * b_lo, hi_lo = a_hi * b_lo;
+    uint64_t lo_hi = a_lo * b_hi, hi_hi = a_hi * b_hi;
+    uint64_t cross = (lo_lo >> 32) + (uint32_t)hi_lo + lo_hi;
+    product.high = hi_hi + (hi_lo >> 32) + (cross >> 32);
+    product.low = (cross << 32) | (uint32_t)lo_lo;
+#endif
+    return product;
+}
+
+static int leading_zeros(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_clzll(x);
+#else
+    int n = 0;
+    while (!(x & 0x8000000000000000ULL)) {
+        x <<= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+// Eisel-Lemire, see "Number Parsing at a Gigabyte per Second" (Lemire, 2021)
+static int eisel_lemire(const Decimal *decimal, double *value)
+{
+    int q = decimal->exponent;
+    if (decimal->truncated || q < MIN_TABLE_POWER || q > MAX_TABLE_POWER)
+        return 0;
+
+    uint64_t w = decimal->mantissa;
+    int lz = leading_zeros(w);
+    w <<= lz;
+
+    // 55 = 52 explicit mantissa bits + 3 bits for rounding
+    const uint64_t precision_mask = 0xFFFFFFFFFFFFFFFFULL >> 55;
+    int index = 2 * (q - MIN_TABLE_POWER);
+    Product product = multiply(w, powers_of_five[index]);
+    if ((product.high & precision_mask) == precision_mask) {
+        Product second = multiply(w, powers_of_five[index + 1]);
+        product.low += second.high;
+        if (second.high > product.low)
+            product.high++;
+    }
+
+    int upperbit = (int)(product.high >> 63);
+    int shift = upperbit + 64 - 52 - 3;
+    uint64_t mantissa = product.high >> shift;
+    // floor(q * log2(10)) + 63, biased by 1023
+    int power2 = ((217706 * q) >> 16) + 63 + upperbit - lz + 1023;
+    if (power2 <= 0)
+        return 0; // subnormal, not reachable within the table range
+
+    // Exactly halfway between two doubles: round to even
+    if (product.low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1) {
+        if ((mantissa << shift) == product.high)
+            mantissa &= ~1ULL;
+    }
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (2ULL << 52)) {
+        mantissa = 1ULL << 52;
+        power2++;
+    }
+    mantissa &= ~(1ULL << 52);
+    if (power2 >= 0x7FF)
+        return 0;
+
+    uint64_t bits = mantissa | ((uint64_t)power2 << 52);
+    memcpy(value, &bits, sizeof(bits));
+    return 1;
+}
+
+static NumberStatus slow_path(const char *str, const char *p, double *value)
+{
+    char buffer[64];
+    size_t length = (size_t)(p - str);
+    char *copy = length < sizeof(buffer) ? buffer : (char *)malloc(length + 1);
+    if (copy == NULL) {
+        *value = 0.0;
+        return NUMBER_INVALID;
+    }
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+
+    int saved = errno;
+    errno = 0;
+    double result = strtod(copy, NULL);
+    NumberStatus status = NUMBER_OK;
+    if (errno == ERANGE)
+        status = fabs(result) < DBL_MIN ? NUMBER_UNDERFLOW : NUMBER_OVERFLOW;
+    errno = saved;
+
+    if (copy != buffer)
+        free(copy);
+    *value = result;
+    return status;
+}
+
+NumberStatus parse_number(const char *str, const char *end,
+    const char **endptr, double *value)
+{
+    Decimal decimal = { 0, 0, 0, 0 };
+    const char *p = scan_digits(&decimal, str, end, 0);
+    int has_digits = p > str;
+    if (p < end && *p == '.') {
+        const char *fraction = p + 1;
+        p = scan_digits(&decimal, fraction, end, 1);
+        has_digits = has_digits || p > fraction;
+    }
+    if (!has_digits) {
+        *endptr = str;
+        *value = 0.0;
+        return NUMBER_INVALID;
+    }
+
+    // The exponent is only consumed when at least one digit follows
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int negative = 0;
+        if (q < end && (*q == '+' || *q == '-')) {
+            negative = *q == '-';
+            q++;
+        }
+        if (q < end && is_digit(*q)) {
+            int exponent = 0;
+            while (q < end && is_digit(*q)) {
+                if (exponent < MAX_EXPONENT)
+                    exponent = exponent * 10 + (*q - '0');
+                q++;
+            }
+            decimal.exponent += negative ? -exponent : exponent;
+            p = q;
+        }
+    }
+
+    *endptr = p;
+    if (fast_path(&decimal, value) || eisel_lemire(&decimal, value))
+        return NUMBER_OK;
+    return slow_path(str, p, value);
+}
+
+long long parse_integer(const char *str, const char *end)
+{
+    unsigned long long result = 0;
+    const char *p = str;
+
+#ifdef NUMBER_SWAR
+    // 16 digits never overflow
+    while (end - p >= 8 && p - str + 8 <= 16) {
+        uint64_t chunk = load_eight(p);
+        if (!is_eight_digits(chunk))
+            break;
+        result = result * 100000000 + eight_digits_value(chunk);
+        p += 8;
+    }
+#endif
+
+    for (; p < end && is_digit(*p); p++) {
+        unsigned digit = (unsigned)(*p - '0');
+        if (result > ((unsigned long long)LLONG_MAX - digit) / 10)
+            return LLONG_MAX;
+        result = result * 10 + digit;
+    }
+    return (long long)result;
+}
@@ -0,0 +1,23 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+// Decimal literal conversion used by the scanner. Unlike strtod() it is
+// bounded by an end pointer, ignores the locale and never touches errno.
+
+typedef enum {
+    NUMBER_OK,
+    NUMBER_INVALID, // no digits at all, for example "."
+    NUMBER_OVERFLOW, // magnitude too large, value is inf
+    NUMBER_UNDERFLOW // magnitude too small, value is 0 or subnormal
+} NumberStatus;
+
+// Convert the literal  digits [ . digits ] [ (e|E) [+|-] digits ]
+// starting at str. *endptr is set past the consumed characters (to str
+// when nothing is consumed). The result is correctly rounded.
+NumberStatus parse_number(const char *str, const char *end,
+    const char **endptr, double *value);
+
+// Value of the leading decimal digits, saturated to LLONG_MAX
+long long parse_integer(const char *str, const char *end);
+
+#endif // NUMBER_H
@@ -0,0 +1,124 @@
+// Round trip of AstFile.h: expressions parsed, saved, loaded and evaluated
+// in place must give the same nodes, text and values. Damaged files must
+// be rejected.
+//
+//   ast_file_test path   writes path and a damaged copy next to it
+
+#include "AstFile.h"
+#include "Calculator.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *expressions[] = {
+    "1+2*3",
+    "-(ans^2)/4.5e-3",
+    "sin(pi/6)+cos(ans)*tan(0.25)",
+    "sqrt(2)^sqrt(2)",
+    "((((ans))))",
+    "1e308*10",
+    "0/0",
+    "-0",
+    "2^-1074",
+    "log(ans)+log(ans)-exp(1)",
+    "+-+-ans*phi-e",
+    "123456789012345678901234567890",
+};
+#define EXPRESSION_COUNT (int)(sizeof(expressions) / sizeof(expressions[0]))
+
+static int failures = 0;
+
+static void check(int ok, const char *what, int index)
+{
+    if (!ok && failures++ < 10)
+        printf("FAIL %s, expression %d\n", what, index);
+}
+
+static int write_bytes(const char *path, const char *data, size_t size)
+{
+    FILE *stream = fopen(path, "wb");
+    if (stream == NULL)
+        return 0;
+    size_t written = fwrite(data, 1, size, stream);
+    fclose(stream);
+    return written == size;
+}
+
+static void round_trip(const char *path, int hash_cons)
+{
+    Calculator *calculator = create_calculator();
+    calculator->diagnostics->mode = DIAGNOSTICS_COLLECT;
+    calculator->hash_cons = hash_cons;
+    AstWriter *writer = create_ast_writer();
+    AstNode *nodes[EXPRESSION_COUNT];
+    int sizes[EXPRESSION_COUNT];
+    double values[EXPRESSION_COUNT];
+
+    for (int i = 0; i < EXPRESSION_COUNT; i++) {
+        recreate_parser(calculator, expressions[i]);
+        const Ast *ast = calculator->parser->ast;
+        check(add_ast(writer, expressions[i], (int)strlen(expressions[i]), ast) == i, "add_ast", i);
+        sizes[i] = ast->root + 1;
+        nodes[i] = (AstNode *)malloc(sizes[i] * sizeof(AstNode));
+        memcpy(nodes[i], ast->nodes, sizes[i] * sizeof(AstNode));
+        calculator->ans = 1.5;
+        values[i] = calculate(calculator);
+    }
+    check(save_ast_file(writer, path), "save_ast_file", -1);
+    free_ast_writer(writer);
+
+    AstFile *file = load_ast_file(path);
+    check(file != NULL && file->count == EXPRESSION_COUNT, "load_ast_file", -1);
+    if (file == NULL) {
+        free_calculator(calculator);
+        return;
+    }
+    for (int i = 0; i < EXPRESSION_COUNT; i++) {
+        Ast ast;
+        int length;
+        const char *text = get_ast_text(file, i, &length);
+        check(length == (int)strlen(expressions[i]) && memcmp(text, expressions[i], length) == 0, "text", i);
+        check(get_ast(file, i, &ast), "get_ast", i);
+        check(ast.root + 1 == sizes[i] && memcmp(ast.nodes, nodes[i], sizes[i] * sizeof(AstNode)) == 0, "nodes", i);
+        calculator->ans = 1.5;
+        double value = calculate_ast(calculator, text, &ast);
+        check(memcmp(&value, &values[i], sizeof(double)) == 0, "value", i);
+        free(nodes[i]);
+    }
+    Ast ast;
+    check(!get_ast(file, -1, &ast) && !get_ast(file, EXPRESSION_COUNT, &ast), "index range", -1);
+
+    // Damaged copies: a forward child index, a truncated file, a bad magic
+    char damaged[4096];
+    snprintf(damaged, sizeof(damaged), "%s.damaged", path);
+    char *data = (char *)malloc(file->size);
+    memcpy(data, file->data, file->size);
+    size_t root = (const char *)&file->nodes[sizes[0] - 1] - file->data;
+    ((AstNode *)(data + root))->child[0] = sizes[0];
+    check(write_bytes(damaged, data, file->size), "write damaged", -1);
+    AstFile *bad = load_ast_file(damaged);
+    check(bad != NULL && !get_ast(bad, 0, &ast) && get_ast(bad, 1, &ast), "child index", 0);
+    free_ast_file(bad);
+
+    memcpy(data, file->data, file->size);
+    check(write_bytes(damaged, data, file->size - 1), "write truncated", -1);
+    check(load_ast_file(damaged) == NULL, "truncated file", -1);
+    data[0] = 'X';
+    check(write_bytes(damaged, data, file->size), "write magic", -1);
+    check(load_ast_file(damaged) == NULL, "bad magic", -1);
+    remove(damaged);
+
+    free(data);
+    free_ast_file(file);
+    free_calculator(calculator);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *path = argc > 1 ? argv[1] : "ast_file_test.ast";
+    round_trip(path, 0);
+    round_trip(path, 1);
+    remove(path);
+    printf("%d expressions, %d failures\n", 2 * EXPRESSION_COUNT, failures);
+    return failures != 0;
+}
@@ -0,0 +1,218 @@
+// Differential test of the compiled engines against calculate(), the tree
+// sweep of eval(): fixed and random formulas, with and without builtins,
+// with hash-consing, constant folding and fast math on and off, and the
+// sweep of a folded tree against the unfolded one. Results must match bit
+// for bit, -0 and inf included, except that any NaN matches any NaN: NaN
+// op NaN keeps either operand's sign depending on how the C compiler
+// ordered them.
+//
+//   engine_test [count]   count formulas of each kind, 20000 by default
+
+#include "Calculator.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_FORMULA 4096
+
+static const char *engine_names[] = { "bytecode", "register", "closure", "jit" };
+#define ENGINE_COUNT (int)(sizeof(engine_names) / sizeof(engine_names[0]))
+
+// Where Jit.c has a code generator, compile_jit() must not fall back to
+// the register code, or the JIT would go untested
+#if defined(__x86_64__) && !defined(_WIN32)
+#define HAVE_JIT 1
+#else
+#define HAVE_JIT 0
+#endif
+
+static const char *atoms[] = {
+    "0", "1", "2", "3", "0.5", "0.1", "7", "10", "1e308", "1e-308", "4.9e-324",
+    "26.347739909153102", "87.737401396523154", "ans", "ans", "pi",
+};
+static const char *functions[] = {
+    "sin", "cos", "tan", "asin", "acos", "atan", "sinh", "cosh", "tanh", "asinh",
+    "acosh", "atanh", "exp", "log", "log10", "log2", "sqrt", "cbrt", "ceil", "floor", "fabs",
+};
+#define COUNT(array) (int)(sizeof(array) / sizeof(array[0]))
+
+// Checked before the random ones: pow() and x*x round these squares apart,
+// fast math shares the operands of nested powers, an engine that
+// evaluates a shared node at every use takes 2^36 steps for the last one
+static const char *fixed[] = {
+    "26.347739909153102^2",
+    "87.737401396523154^2",
+    "(ans*26.347739909153102)^2",
+    "((((ans*0+1.0000001)^64)^64)^64)^32",
+    "((((((ans*0+1.0000001)^64)^64)^64)^64)^64)^64",
+    // Folded constants must keep signed zeros, inf and NaN
+    "-0*1", "1/-0", "0/0", "log(0)", "-(0)", "-0+0", "-0-0", "(-0)^3",
+    "sqrt(-0)", "1/(-(0)*pi)", "ans*(1/-0)", "ans+log(0)-log(0)", "-(0/0)*ans",
+    "1e308*10", "-1e308*10", "ans*(-1e308*10+1e308*10)", "exp(1000)*0",
+};
+
+static uint64_t state = 0x2545F4914F6CDD1DULL;
+
+static int random_below(int n)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (int)((state * 0x2545F4914F6CDD1DULL >> 33) % (uint64_t)n);
+}
+
+typedef struct Formula {
+    char text[MAX_FORMULA];
+    int length;
+    int calls; // builtins allowed
+} Formula;
+
+static void append(Formula *formula, const char *text)
+{
+    int length = (int)strlen(text);
+    if (formula->length + length < MAX_FORMULA) {
+        memcpy(formula->text + formula->length, text, length + 1);
+        formula->length += length;
+    }
+}
+
+static void generate(Formula *formula, int depth)
+{
+    int kind = depth == 0 ? 0 : random_below(10);
+    if (kind <= 1) {
+        append(formula, atoms[random_below(COUNT(atoms))]);
+    } else if (kind == 2) {
+        append(formula, random_below(2) ? "-" : "+");
+        generate(formula, depth - 1);
+    } else if (kind == 3) {
+        append(formula, "(");
+        generate(formula, depth - 1);
+        append(formula, ")");
+    } else if (kind == 4 && formula->calls) {
+        append(formula, functions[random_below(COUNT(functions))]);
+        append(formula, "(");
+        generate(formula, depth - 1);
+        append(formula, ")");
+    } else if (kind == 5) {
+        static const char *powers[] = { "^2", "^3", "^0.5", "^-1", "^8", "^0" };
+        append(formula, "(");
+        generate(formula, depth - 1);
+        append(formula, ")");
+        append(formula, powers[random_below(COUNT(powers))]);
+    } else {
+        static const char *operators[] = { "+", "-", "*", "/", "^" };
+        generate(formula, depth - 1);
+        append(formula, operators[random_below(COUNT(operators))]);
+        generate(formula, depth - 1);
+    }
+}
+
+static int same(double expected, double actual)
+{
+    if (isnan(expected) || isnan(actual))
+        return isnan(expected) && isnan(actual);
+    return memcmp(&expected, &actual, sizeof(double)) == 0;
+}
+
+// Returns the number of mismatches
+static int check(Calculator *calculator, const Formula *formula)
+{
+    int mismatches = 0;
+    calculator->ans = 1.0;
+    recreate_parser(calculator, formula->text);
+    double expected = calculate(calculator);
+    if (!calculator->status)
+        return 0;
+    for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+        calculator->engine = (Engine)engine;
+        recreate_parser(calculator, formula->text);
+        Program *program = calculator_compile(calculator);
+        if (engine == ENGINE_JIT && HAVE_JIT && program->engine != ENGINE_JIT) {
+            printf("%s: compile_jit() failed, the register code ran\n", formula->text);
+            mismatches++;
+        }
+        calculator->ans = 1.0;
+        double actual = calculator_run(calculator, program);
+        free_program(program);
+        if (!same(expected, actual) && mismatches++ == 0) {
+            printf("%s, hash_cons %d, fold %d, fast_math %d: %s\n  eval %.17g, %s %.17g\n",
+                formula->calls ? "builtins" : "arithmetic", calculator->hash_cons, calculator->fold,
+                calculator->fast_math, formula->text, expected, engine_names[engine], actual);
+        }
+    }
+    return mismatches;
+}
+
+// fold_constants() against the unfolded tree, returns the number of
+// mismatches. Fast math is off, its rewrites depend on what is folded.
+static int check_fold(Calculator *calculator, const Formula *formula)
+{
+    int mismatches = 0;
+    calculator->fast_math = 0;
+    for (int hash_cons = 0; hash_cons < 2; hash_cons++) {
+        double values[2];
+        int status[2];
+        calculator->hash_cons = hash_cons;
+        for (int fold = 0; fold < 2; fold++) {
+            calculator->fold = fold;
+            calculator->ans = 1.0;
+            recreate_parser(calculator, formula->text);
+            values[fold] = calculate(calculator);
+            status[fold] = calculator->status;
+        }
+        if (status[0] != status[1] || (status[0] && !same(values[0], values[1]))) {
+            printf("fold, hash_cons %d: %s\n  unfolded %.17g, folded %.17g\n",
+                hash_cons, formula->text, values[0], values[1]);
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+#define OPTIONS 8
+
+// Check a formula with hash-consing, folding and fast math on and off and
+// the folded against the unfolded value, returns the number of failures
+static int check_options(Calculator *calculator, const Formula *formula)
+{
+    int failures = 0;
+    for (int options = 0; options < OPTIONS; options++) {
+        calculator->hash_cons = options & 1;
+        calculator->fold = (options >> 1) & 1;
+        calculator->fast_math = options >> 2;
+        failures += check(calculator, formula) != 0;
+    }
+    return failures + check_fold(calculator, formula);
+}
+
+int main(int argc, char *argv[])
+{
+    int count = argc > 1 ? atoi(argv[1]) : 20000;
+    Calculator *calculator = create_calculator();
+    calculator->diagnostics->mode = DIAGNOSTICS_COLLECT;
+    long formulas = 0, failures = 0;
+    for (int i = 0; i < COUNT(fixed); i++) {
+        Formula formula = { "", 0, 0 };
+        append(&formula, fixed[i]);
+        recreate_parser(calculator, formula.text);
+        if (!calculator->parser->status) {
+            printf("Cannot parse %s\n", formula.text);
+            failures++;
+        }
+        failures += check_options(calculator, &formula);
+        formulas += OPTIONS;
+    }
+    for (int calls = 0; calls < 2; calls++) {
+        for (int i = 0; i < count; i++) {
+            Formula formula = { "", 0, calls };
+            generate(&formula, 1 + random_below(8));
+            failures += check_options(calculator, &formula);
+            formulas += OPTIONS;
+        }
+    }
+    printf("%ld formulas, %ld failures\n", formulas, failures);
+    free_calculator(calculator);
+    return failures != 0;
+}
@@ -0,0 +1,195 @@
+// Differential test of parse_number() against strtod() on edge cases and
+// random decimal literals: values must be the same bit for bit, the end
+// pointer the same and overflow and underflow reported where strtod()
+// sets ERANGE.
+//
+//   number_test [count]          test count literals, 1000000 by default
+//   number_test --bench [count]  time both on the same literals
+
+#include "number.h"
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_LITERAL 64
+
+static uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64*, the same literals on every run
+static uint64_t next_random()
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1DULL;
+}
+
+static int random_below(int n)
+{
+    return (int)(next_random() % (uint64_t)n);
+}
+
+static void append_digits(char *buffer, int *length, int count)
+{
+    for (int i = 0; i < count; i++)
+        buffer[(*length)++] = (char)('0' + random_below(10));
+}
+
+// digits [ . digits ] [ e [+|-] digits ], with mantissas around the 19
+// digit limit, exponents at the edges of the double range and a few
+// literals close to a rounding boundary
+static int random_literal(char *buffer)
+{
+    int length = 0;
+    int kind = random_below(8);
+    if (kind == 0) { // halfway cases between two doubles
+        double value = ldexp((double)(next_random() >> 11), random_below(200) - 100);
+        length = snprintf(buffer, MAX_LITERAL, "%.17e", value);
+        char *exponent = strchr(buffer, 'e');
+        exponent[-1] = '5';
+        if (random_below(2)) { // decided only by a digit past the 19th
+            static const char *tails[] = { "000000000000001", "999999999999999", "000000000000000" };
+            const char *tail = tails[random_below(3)];
+            int size = (int)strlen(tail);
+            memmove(exponent + size, exponent, strlen(exponent) + 1);
+            memcpy(exponent, tail, size);
+            length += size;
+        }
+        return length;
+    }
+    append_digits(buffer, &length, 1 + random_below(kind == 1 ? 30 : 20));
+    if (random_below(2)) {
+        buffer[length++] = '.';
+        append_digits(buffer, &length, random_below(kind == 1 ? 20 : 12));
+    }
+    if (random_below(3)) {
+        buffer[length++] = random_below(2) ? 'e' : 'E';
+        if (random_below(2))
+            buffer[length++] = random_below(2) ? '-' : '+';
+        int exponent = kind == 2 ? 290 + random_below(60) : random_below(60);
+        length += snprintf(buffer + length, MAX_LITERAL - length, "%d", exponent);
+    }
+    return length;
+}
+
+// Edges of the syntax and of the range, tested before the random literals
+static const char *edge_literals[] = {
+    ".5", ".", "5.", "0.", "00.000", "1e", "1e+", "1e-", "1E+x", "1.5e", ".e5",
+    "0e999999", "0e-999999", "1e999999", "1e-999999", "0.0000e400",
+    "1e308", "1.7976931348623157e308", "1.7976931348623158e308",
+    "1.7976931348623159e308", "1e309", "2.2250738585072014e-308",
+    "2.2250738585072011e-308", "4.9406564584124654e-324", "2.4703282292062327e-324",
+    "2.4703282292062328e-324", "1e-324", "1e-400",
+    "18446744073709551615", "18446744073709551616", "9007199254740993",
+    "9007199254740992.5", "9007199254740993.0000000000000000000001",
+    "9007199254740992.9999999999999999999999", "1.00000000000000011102230246251565404",
+    "1.00000000000000011102230246251565405", "0.1000000000000000055511151231257827021181583404541015625",
+    "123456789012345678901234567890e-20",
+};
+#define EDGE_COUNT (int)(sizeof(edge_literals) / sizeof(edge_literals[0]))
+
+// Status strtod() implies: ERANGE with inf is an overflow, with 0 or a
+// subnormal an underflow
+static NumberStatus expected_status(const char *literal, const char *end, double value, int range)
+{
+    if (end == literal)
+        return NUMBER_INVALID;
+    if (range)
+        return isinf(value) ? NUMBER_OVERFLOW : NUMBER_UNDERFLOW;
+    return NUMBER_OK;
+}
+
+// buffer holds length characters and room for one more, returns 1 if
+// parse_number() agrees with strtod()
+static int check_literal(char *buffer, int length)
+{
+    buffer[length] = '\0';
+    char *expected_end;
+    errno = 0;
+    double expected = strtod(buffer, &expected_end);
+    NumberStatus expected_code = expected_status(buffer, expected_end, expected, errno == ERANGE);
+
+    // A digit past the end must not be read
+    buffer[length] = '7';
+    const char *end;
+    double value = 0.0;
+    NumberStatus status = parse_number(buffer, buffer + length, &end, &value);
+    buffer[length] = '\0';
+
+    int ok = end - buffer == expected_end - buffer && status == expected_code
+        && (status == NUMBER_INVALID || memcmp(&value, &expected, sizeof(double)) == 0);
+    static int printed = 0;
+    if (!ok && printed++ < 10)
+        printf("%s: parse_number %.17g (status %d, %d characters), strtod %.17g (status %d, %d characters)\n",
+            buffer, value, status, (int)(end - buffer), expected, expected_code, (int)(expected_end - buffer));
+    return ok;
+}
+
+static int run_test(long count)
+{
+    long failures = 0;
+    char buffer[MAX_LITERAL + 2];
+    for (int i = 0; i < EDGE_COUNT; i++) {
+        int length = (int)strlen(edge_literals[i]);
+        memcpy(buffer, edge_literals[i], length);
+        failures += !check_literal(buffer, length);
+    }
+    for (long i = 0; i < count; i++) {
+        int length = random_literal(buffer);
+        failures += !check_literal(buffer, length);
+    }
+    printf("%d edge and %ld random literals, %ld failures\n", EDGE_COUNT, count, failures);
+    return failures != 0;
+}
+
+static int run_bench(long count)
+{
+    char *text = (char *)malloc(count * (MAX_LITERAL + 1));
+    int *lengths = (int *)malloc(count * sizeof(int));
+    long bytes = 0;
+    char *p = text;
+    for (long i = 0; i < count; i++) {
+        lengths[i] = random_literal(p);
+        p[lengths[i]] = '\0';
+        p += lengths[i] + 1;
+        bytes += lengths[i];
+    }
+
+    double sum = 0.0;
+    clock_t start = clock();
+    p = text;
+    for (long i = 0; i < count; i++) {
+        const char *end;
+        double value;
+        parse_number(p, p + lengths[i], &end, &value);
+        sum += value;
+        p += lengths[i] + 1;
+    }
+    double fast = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    start = clock();
+    p = text;
+    for (long i = 0; i < count; i++) {
+        sum += strtod(p, NULL);
+        p += lengths[i] + 1;
+    }
+    double slow = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("parse_number %7.1f ns, %7.1f MB/s\n", fast * 1e9 / count, bytes / fast / 1e6);
+    printf("strtod       %7.1f ns, %7.1f MB/s\n", slow * 1e9 / count, bytes / slow / 1e6);
+    printf("(checksum %g)\n", sum);
+    free(text);
+    free(lengths);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0)
+        return run_bench(argc > 2 ? atol(argv[2]) : 1000000);
+    return run_test(argc > 1 ? atol(argv[1]) : 1000000);
+}
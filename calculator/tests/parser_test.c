@@ -0,0 +1,67 @@
+// Diagnostics of malformed expressions: each must report exactly the
+// expected errors, one mistake is not reported twice. Also the arena after
+// an expression that outgrew it.
+
+#include "Calculator.h"
+#include <stdio.h>
+#include <string.h>
+
+typedef struct Case {
+    const char *expression;
+    int count; // diagnostics
+    DiagnosticId first;
+    int position; // of the first diagnostic
+} Case;
+
+static const Case cases[] = {
+    { "sin()", 1, DIAG_EXPECTED_ARGUMENT, 4 },
+    { "sin()+1", 1, DIAG_EXPECTED_ARGUMENT, 4 },
+    { "(sin())", 1, DIAG_EXPECTED_ARGUMENT, 5 },
+    { "sin(1", 1, DIAG_EXPECTED_RPAREN, 5 },
+    { "(1+2", 1, DIAG_EXPECTED_RPAREN, 4 },
+    { "1+", 1, DIAG_EXPECTED_RIGHT_OPERAND, 2 },
+    { "foo(1)", 1, DIAG_UNKNOWN_FUNCTION, 0 },
+    { "bar", 1, DIAG_UNKNOWN_CONSTANT, 0 },
+    { "1e999", 1, DIAG_NUMBER_OVERFLOW, 0 },
+    { "1e-999", 1, DIAG_NUMBER_UNDERFLOW, 0 },
+};
+#define CASE_COUNT (int)(sizeof(cases) / sizeof(cases[0]))
+
+int main(void)
+{
+    Calculator *calculator = create_calculator();
+    calculator->diagnostics->mode = DIAGNOSTICS_COLLECT;
+    int failures = 0;
+    for (int i = 0; i < CASE_COUNT; i++) {
+        const Case *test = &cases[i];
+        recreate_parser(calculator, test->expression);
+        int count;
+        const Diagnostic *diagnostics = get_diagnostics(calculator, &count);
+        if (count != test->count || diagnostics[0].id != test->first
+            || diagnostics[0].position != test->position) {
+            printf("%s: %d diagnostics, expected %d\n", test->expression, count, test->count);
+            print_diagnostics(calculator->diagnostics, stdout);
+            failures++;
+        }
+    }
+    // An expression larger than the arena chains blocks, the next one
+    // starts in a single block of the high-water size
+    static char sum[200001];
+    for (int i = 0; i < 100000; i++)
+        memcpy(sum + 2 * i, "1+", 2);
+    sum[199999] = '\0'; // the last +
+    recreate_parser(calculator, sum);
+    if (calculate(calculator) != 100000.0 || !arena_outgrown(calculator->arena)) {
+        printf("long sum: %g\n", calculator->ans);
+        failures++;
+    }
+    recreate_parser(calculator, "2*3");
+    if (calculate(calculator) != 6.0 || arena_outgrown(calculator->arena)) {
+        printf("2*3 after the long sum: %g\n", calculator->ans);
+        failures++;
+    }
+
+    printf("%d cases, %d failures\n", CASE_COUNT, failures);
+    free_calculator(calculator);
+    return failures != 0;
+}
@@ -0,0 +1,115 @@
+// Differential test of retokenize() against a full tokonize(): random
+// edits of random expressions must leave the same tokens and status as
+// scanning the edited text from the start.
+//
+//   scanner_test [count]   test count edits, 1000000 by default
+
+#include "Scanner.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TEXT 96
+#define MAX_PIECE 8
+
+// Pieces of lexemes, so edits split and join numbers, exponents and names
+static const char *pieces[] = {
+    "1", "23", "0", ".", ".5", "e", "E", "e+", "e-", "1e3", "2.5e-3", "1e999",
+    "+", "-", "*", "/", "^", "(", ")", " ", "  ", "sin", "cos(", "pi", "ans",
+    "x", "log", "10", "#", "$", "99999999999999999999",
+};
+#define PIECE_COUNT (int)(sizeof(pieces) / sizeof(pieces[0]))
+
+static uint64_t state = 0x9E3779B97F4A7C15ULL;
+
+// xorshift64*, the same edits on every run
+static int random_below(int n)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return (int)((state * 0x2545F4914F6CDD1DULL >> 33) % (uint64_t)n);
+}
+
+// Up to MAX_PIECE characters of random pieces
+static int random_text(char *buffer, int capacity)
+{
+    int length = 0;
+    int count = random_below(3) + 1;
+    for (int i = 0; i < count; i++) {
+        const char *piece = pieces[random_below(PIECE_COUNT)];
+        int size = (int)strlen(piece);
+        if (length + size > capacity)
+            break;
+        memcpy(buffer + length, piece, size);
+        length += size;
+    }
+    return length;
+}
+
+static int same_tokens(const TokenList *expected, const TokenList *actual)
+{
+    if (expected->size != actual->size)
+        return 0;
+    for (int i = 0; i < expected->size; i++) {
+        const Token *a = &expected->tokens[i];
+        const Token *b = &actual->tokens[i];
+        if (a->type != b->type || a->position != b->position || a->length != b->length)
+            return 0;
+        if (a->type == ID && a->symbol != b->symbol)
+            return 0;
+        if ((a->type == FLOAT || a->type == INTEGER)
+            && memcmp(&a->number, &b->number, sizeof(double)) != 0)
+            return 0;
+        if (a->type == INTEGER && a->integer != b->integer)
+            return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    long count = argc > 1 ? atol(argv[1]) : 1000000;
+    char text[MAX_TEXT + MAX_PIECE + 1] = "";
+    char inserted[MAX_PIECE];
+    int length = 0;
+    Scanner *scanner = create_scanner(text, NULL, NULL);
+    Scanner *reference = create_scanner(text, NULL, NULL);
+    tokonize(scanner);
+    long failures = 0;
+    for (long edit = 0; edit < count; edit++) {
+        if (random_below(200) == 0) { // start over on a fresh expression
+            length = 0;
+            text[0] = '\0';
+            reset_scanner(scanner, text, 0);
+            tokonize(scanner);
+        }
+        int offset = random_below(length + 1);
+        int removed = random_below(4);
+        if (removed > length - offset)
+            removed = length - offset;
+        int added = random_text(inserted, MAX_PIECE);
+        if (length - removed + added > MAX_TEXT)
+            added = 0;
+        memmove(text + offset + added, text + offset + removed, length - offset - removed + 1);
+        memcpy(text + offset, inserted, added);
+        length += added - removed;
+        retokenize(scanner, text, offset, removed, added);
+
+        reset_scanner(reference, text, length);
+        tokonize(reference);
+        if (!same_tokens(reference->token_list, scanner->token_list)
+            || reference->status != scanner->status) {
+            if (failures++ < 10)
+                printf("edit %ld at %d, -%d +%d: \"%s\"\n", edit, offset, removed, added, text);
+            // Continue from a correct token list
+            reset_scanner(scanner, text, length);
+            tokonize(scanner);
+        }
+    }
+    printf("%ld edits, %ld failures\n", count, failures);
+    free_scanner(reference);
+    free_scanner(scanner);
+    return failures != 0;
+}
@@ -0,0 +1,64 @@
+// The hand-written slot table of Symbol.c against the symbol table: every
+// name must find its own id in any case, and a name that is not a builtin
+// must not find one.
+
+#include "Symbol.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+
+static void expect(const char *name, int length, int id)
+{
+    int found = intern_symbol(name, length);
+    if (found != id) {
+        printf("intern_symbol(\"%.*s\") is %d, expected %d\n", length, name, found, id);
+        failures++;
+    }
+}
+
+// The id of a lower case name by a linear search, SYMBOL_UNKNOWN if none
+static int find_symbol(const char *name, int length)
+{
+    for (int id = 0; id < symbol_count(); id++) {
+        const char *symbol = get_symbol(id)->name;
+        if ((int)strlen(symbol) == length && memcmp(symbol, name, length) == 0)
+            return id;
+    }
+    return SYMBOL_UNKNOWN;
+}
+
+int main(void)
+{
+    char name[64];
+    int count = symbol_count();
+    for (int id = 0; id < count; id++) {
+        const char *lower = get_symbol(id)->name;
+        int length = (int)strlen(lower);
+        expect(lower, length, id);
+        for (int i = 0; i < length; i++)
+            name[i] = (char)toupper((unsigned char)lower[i]);
+        expect(name, length, id);
+        name[0] = lower[0]; // mixed case
+        expect(name, length, id);
+
+        // One character more, one less and the last one changed
+        memcpy(name, lower, length);
+        name[length] = 'q';
+        expect(name, length + 1, find_symbol(name, length + 1));
+        expect(name, length - 1, find_symbol(name, length - 1));
+        for (char ch = 'a'; ch <= 'z'; ch++) {
+            name[length - 1] = ch;
+            expect(name, length, find_symbol(name, length));
+        }
+    }
+
+    int ids[64];
+    if (complete_symbol("", 0, ids, 64) != count) {
+        printf("complete_symbol(\"\") misses symbols\n");
+        failures++;
+    }
+    printf("%d symbols, %d failures\n", count, failures);
+    return failures != 0;
+}